@@ -8,6 +8,7 @@ QT += core gui opengl widgets
 
 TARGET = 3Dviewer
 TEMPLATE = app
+CONFIG += c++17
 
 # The following define makes your compiler emit warnings if you use
 # any feature of Qt which has been marked as deprecated (the exact warnings
@@ -27,17 +28,29 @@ SOURCES += \
     mainWindow.cpp \
     scene3d.cpp \
     common.cpp \
-    dialogbuildorientation.cpp
+    dialogbuildorientation.cpp \
+    meshcache.cpp \
+    meshcodec.cpp \
+    modelarena.cpp \
+    gpubuffer.cpp \
+    thumbnailbatch.cpp \
+    rasterizer.cpp
 
 HEADERS += \
     functions.h \
     mainWindow.h \
     scene3d.h \
     common.h \
-    dialogbuildorientation.h
+    dialogbuildorientation.h \
+    meshcache.h \
+    meshcodec.h \
+    modelarena.h \
+    gpubuffer.h \
+    thumbnailbatch.h \
+    rasterizer.h
 
 FORMS += \
     scene3d.ui \
     dialogbuildorientation.ui
 
-win32: LIBS += -lOpenGL32
+win32: LIBS += -lOpenGL32 -lpsapi
@@ -57,6 +57,16 @@ Vertex Vertex::operator /(double val) const
     return {x / val, y / val, z / val};
 }
 
+bool Vertex::operator ==(const Vertex &other) const
+{
+    return x == other.x && y == other.y && z == other.z;
+}
+
+bool Vertex::operator !=(const Vertex &other) const
+{
+    return !(*this == other);
+}
+
 Vertex &Vertex::operator +=(const Vertex &other)
 {
     x += other.x;
@@ -123,6 +133,101 @@ double Vector::length() const
     return sqrt(x * x + y * y + z * z);
 }
 
+VertexF::VertexF() : x(0), y(0), z(0)
+{
+}
+
+VertexF::VertexF(double xp, double yp, double zp)
+    : x(static_cast<float>(xp))
+    , y(static_cast<float>(yp))
+    , z(static_cast<float>(zp))
+{
+}
+
+VertexF::VertexF(const Vertex &p)
+    : VertexF(p.x, p.y, p.z)
+{
+}
+
+VertexF::operator Vertex() const
+{
+    return Vertex(static_cast<double>(x), static_cast<double>(y), static_cast<double>(z));
+}
+
+namespace {
+
+inline double signNotZero(double val)
+{
+    return val < 0.0 ? -1.0 : 1.0;
+}
+
+inline int16_t packSnorm(double val)
+{
+    if (val < -1.0)
+        val = -1.0;
+    else if (val > 1.0)
+        val = 1.0;
+    return static_cast<int16_t>(lround(val * 32767.0));
+}
+
+}
+
+PackedNormal::PackedNormal() : x(0), y(0)
+{
+}
+
+PackedNormal::PackedNormal(const Vector &nor)
+{
+    // project the vector onto the octahedron |x| + |y| + |z| = 1,
+    // the lower half is folded over the diagonals of the upper one
+    double sum = fabs(nor.x) + fabs(nor.y) + fabs(nor.z);
+    double u = 0.0;
+    double v = 0.0;
+    if (sum > 0.0)
+    {
+        u = nor.x / sum;
+        v = nor.y / sum;
+        if (nor.z < 0.0)
+        {
+            double uFolded = (1.0 - fabs(v)) * signNotZero(u);
+            double vFolded = (1.0 - fabs(u)) * signNotZero(v);
+            u = uFolded;
+            v = vFolded;
+        }
+    }
+    x = packSnorm(u);
+    y = packSnorm(v);
+}
+
+Vector PackedNormal::unpack() const
+{
+    double u = x / 32767.0;
+    double v = y / 32767.0;
+    double w = 1.0 - fabs(u) - fabs(v);
+    if (w < 0.0)
+    {
+        double uUnfolded = (1.0 - fabs(v)) * signNotZero(u);
+        double vUnfolded = (1.0 - fabs(u)) * signNotZero(v);
+        u = uUnfolded;
+        v = vUnfolded;
+    }
+
+    Vector nor(u, v, w);
+    double len = nor.length();
+    if (len > 0.0)
+    {
+        nor.x /= len;
+        nor.y /= len;
+        nor.z /= len;
+    }
+    return nor;
+}
+
+Triangle::Triangle()
+{
+    coord[0] = coord[1] = coord[2] = 0;
+}
+
 Triangle::Triangle(uint32_t i1, uint32_t i2, uint32_t i3)
 {
     coord[0] = i1;
@@ -130,6 +235,11 @@ Triangle::Triangle(uint32_t i1, uint32_t i2, uint32_t i3)
     coord[2] = i3;
 }
 
+Edge::Edge()
+{
+    coord[0] = coord[1] = 0;
+}
+
 Edge::Edge(unsigned int i1, unsigned int i2)
 {
     coord[0] = i1;
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <iostream>
+#include <vector>
+#include <stdint.h>
 
 // the constants of STL file types
 #define STL_INVALID -1
@@ -32,6 +34,8 @@ struct Vertex {
     Vertex &operator -= (const Vertex &other);
     Vertex &operator *= (double val);
     Vertex &operator /= (double val);
+    bool operator == (const Vertex &other) const;
+    bool operator != (const Vertex &other) const;
 };
 std::ostream& operator<<(std::ostream& out, const Vertex &p);
 
@@ -56,15 +60,97 @@ struct Vector : Vertex
     double length() const;
 };
 
+// the compact vertex to store and draw the model, the coordinates are relative
+// to the center of model so float keeps enough precision
+struct VertexF
+{
+    float x;
+    float y;
+    float z;
+
+    VertexF();
+    VertexF(double xp, double yp, double zp);
+    explicit VertexF(const Vertex &p);
+
+    operator Vertex() const;
+};
+
+// the unit vector packed by octahedral mapping into two 16-bit numbers
+// (the error of direction is less than 1E-4 rad)
+struct PackedNormal
+{
+    int16_t x;
+    int16_t y;
+
+    PackedNormal();
+    explicit PackedNormal(const Vector &nor);
+
+    Vector unpack() const;
+};
+
 struct Triangle
 {
+    Triangle();
     Triangle(uint32_t i1, uint32_t i2, uint32_t i3);
     uint32_t coord[3];
 };
 
 struct Edge
 {
+    Edge();
     Edge(unsigned int i1, unsigned int i2);
     uint32_t coord[2];
 };
+
+// the compressed sparse rows: the items of row i are
+// indices[offsets[i]] .. indices[offsets[i + 1] - 1]
+struct Adjacency
+{
+    // the items of one row, to iterate them by range-for
+    struct Row
+    {
+        const uint32_t *first;
+        const uint32_t *last;
+
+        inline const uint32_t *begin() const {return first;}
+        inline const uint32_t *end() const {return last;}
+        inline size_t size() const {return static_cast<size_t>(last - first);}
+    };
+
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> indices;
+
+    inline size_t size() const {return offsets.empty() ? 0 : offsets.size() - 1;}
+    inline bool empty() const {return size() == 0;}
+    inline Row operator[](size_t i) const
+    {
+        return {indices.data() + offsets[i], indices.data() + offsets[i + 1]};
+    }
+    inline void clear() {offsets.clear(); indices.clear();}
+};
+
+// the merge tree of neighbor triangles by the angle between their normals:
+// the faces for the threshold are the groups joined by the merges with dot >= threshold
+struct MergeTree
+{
+    struct Merge
+    {
+        float dot;      // the dot product of normals
+        uint32_t tri1;
+        uint32_t tri2;
+    };
+
+    // the merges joining the different groups, sorted by dot descending
+    std::vector<Merge> merges;
+
+    inline bool empty() const {return merges.empty();}
+    inline void clear() {merges.clear();}
+};
+
+// the simplified copy of mesh drawn instead of it while the view is changed
+struct MeshLevel
+{
+    std::vector<VertexF> vertices;
+    std::vector<Triangle> triangles;
+};
 }
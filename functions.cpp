@@ -1,274 +1,2356 @@
 #include "common.h"
 #include "functions.h"
+#include "meshcodec.h"
 #include <QFile>
-#include <QFileInfo>
 #include <QDebug>
-#include <QByteArray>
-#include <fstream>
+#include <charconv>
+#include <string.h>
+#include <stdio.h>
+#include <thread>
+#include <string>
+#include <algorithm>
+#include <stdint.h>
 #include <float.h>
 #include <math.h>
+#include <ctype.h>
+#include <mutex>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OVERHANG_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef Q_OS_UNIX
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#ifdef Q_OS_WIN
+#include <windows.h>
+#include <psapi.h>
+#endif
 
-// define the type of STL file (ascii or binary)
-int getStlFileFormat(const QString &path)
+MappedFile::~MappedFile()
 {
-    // input variables:
-    // path - the path of file to load
+    close();
+}
 
-    // get the file
-    QFile file(path);
-    if (!file.open(QIODevice::ReadOnly))
+bool MappedFile::open(const QString &path)
+{
+    close();
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly))
     {
-        // can't open, return error
         qDebug("\n\tUnable to open \"%s\"", qPrintable(path));
-        return STL_INVALID;
+        return false;
+    }
+
+    m_size = static_cast<uint64_t>(m_file.size());
+    if (m_size == 0)
+        return true;
+
+    m_data = m_file.map(0, m_file.size());
+    if (m_data == nullptr)
+    {
+        qDebug("\n\tUnable to map \"%s\"", qPrintable(path));
+        m_file.close();
+        m_size = 0;
+        return false;
     }
-    // get the size of file (bytes)
-    QFileInfo fileInfo(path);
-    size_t fileSize = static_cast<size_t>(fileInfo.size());
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (m_data != nullptr)
+        m_file.unmap(m_data);
+    m_data = nullptr;
+    m_size = 0;
+    m_file.close();
+}
+
+void MappedFile::adviseSequential() const
+{
+#ifdef Q_OS_UNIX
+    if (m_data == nullptr)
+        return;
+    // the mapping starts on the page boundary
+    madvise(m_data, m_size, MADV_SEQUENTIAL);
+    madvise(m_data, m_size, MADV_WILLNEED);
+#endif
+}
+
+// define the type of STL file (ascii or binary)
+int getStlFileFormat(const MappedFile &file)
+{
+    // input variables:
+    // file - the mapped file to load, only the header and the tail are read
+
+    const uint64_t fileSize = file.size();
+    const char *data = reinterpret_cast<const char*>(file.data());
 
     // check the size of file
     if (fileSize < 15)
     {
         // the size is too short, return error
-        qDebug("\n\tThe STL file is not long enough (%u bytes).", uint(fileSize));
+        qDebug("\n\tThe STL file is not long enough (%llu bytes).", static_cast<unsigned long long>(fileSize));
         return STL_INVALID;
     }
 
     // check the header of ascii STL
-    QByteArray sixBytes = file.read(6);
-    if (sixBytes.startsWith("solid "))
+    if (memcmp(data, "solid ", 6) == 0)
     {
-        // loop over lines of file
-        QByteArray buf;
-        QByteArray prev;
-        do
-        {
-            prev = buf;
-            buf = file.readLine();
-        } while (!buf.isEmpty());
+        // skip the trailing whitespaces and empty lines
+        const char *end = data + fileSize;
+        while (end > data && isspace(static_cast<unsigned char>(end[-1])))
+            --end;
+        // find the start of the last line
+        const char *lastLine = end;
+        while (lastLine > data && lastLine[-1] != '\n')
+            --lastLine;
+        while (lastLine < end && isspace(static_cast<unsigned char>(*lastLine)))
+            ++lastLine;
         // check the ending of ascii STL
-        if (prev.startsWith("endsolid"))
+        if (end - lastLine >= 8 && memcmp(lastLine, "endsolid", 8) == 0)
             // header and ending are proper, return ascii type
             return STL_ASCII;
     }
 
-    // come back to start of file
-    if (!file.reset())
-    {
-        // can't do, return error
-        qDebug("\n\tCannot seek to the 0th byte (before the header)");
-        return STL_INVALID;
-    }
-
     // check the size of file (the minimum is longer for binary)
     if (fileSize < 84)
     {
         // the size is too short, return error
-        qDebug("\n\tThe STL file is not long enough (%u bytes).", uint(fileSize));
+        qDebug("\n\tThe STL file is not long enough (%llu bytes).", static_cast<unsigned long long>(fileSize));
         return STL_INVALID;
     }
 
-    // skip the header of binary STL
-    if (!file.seek(80))
+    // read the number of facets (after the header)
+    uint32_t nTriangles;
+    memcpy(&nTriangles, data + 80, sizeof(nTriangles));
+    // check the length of file (header + facets), 64 bits to support files over 4 GB
+    if (fileSize == (84 + (static_cast<uint64_t>(nTriangles) * 50)))
+        // if proper return binary type
+        return STL_BINARY;
+
+    // not proper, return error
+    return STL_INVALID;
+}
+
+// get the size of cell of welding grid and the real tolerance
+static double weldToleranceValue(const std::vector<common::Vertex> &soup,
+                                 const WeldTolerance &tolerance)
+{
+    if (!tolerance.relative)
+        return tolerance.value;
+
+    // the tolerance is relative to the diagonal of bounding box
+    common::Vertex boxMin = { DBL_MAX, DBL_MAX, DBL_MAX};
+    common::Vertex boxMax = {-DBL_MAX,-DBL_MAX,-DBL_MAX};
+    for (const common::Vertex &p : soup)
     {
-        // can't do, return error
-        qDebug("\n\tCannot seek to the 80th byte (after the header)");
-        return STL_INVALID;
+        boxMin.x = std::min(boxMin.x, p.x);
+        boxMin.y = std::min(boxMin.y, p.y);
+        boxMin.z = std::min(boxMin.z, p.z);
+        boxMax.x = std::max(boxMax.x, p.x);
+        boxMax.y = std::max(boxMax.y, p.y);
+        boxMax.z = std::max(boxMax.z, p.z);
     }
+    if (soup.empty())
+        return 0.0;
+    return tolerance.value * common::Vector(boxMin, boxMax).length();
+}
+
+// hash the integer coordinates of grid cell
+static inline uint64_t weldCellHash(int64_t cx, int64_t cy, int64_t cz)
+{
+    uint64_t h = static_cast<uint64_t>(cx) * 0x9E3779B97F4A7C15ull;
+    h ^= static_cast<uint64_t>(cy) * 0xC2B2AE3D27D4EB4Full;
+    h ^= static_cast<uint64_t>(cz) * 0x165667B19E3779F9ull;
+    return h ^ (h >> 29);
+}
+
+// get the integer grid coordinate of value
+static inline int64_t weldCellCoord(double value, double cellSize)
+{
+    double c = floor(value / cellSize);
+    // keep far points inside of integer range, they are compared exactly anyway
+    if (c > 4.0E18)
+        return static_cast<int64_t>(4.0E18);
+    if (c < -4.0E18)
+        return static_cast<int64_t>(-4.0E18);
+    return static_cast<int64_t>(c);
+}
+
+namespace {
 
-    // read the number of facets
-    QByteArray nTrianglesBytes = file.read(4);
-    if (nTrianglesBytes.size() != 4)
+// the marker of chain's end
+const uint32_t noVertex = UINT32_MAX;
+
+// the hash grid of welded vertices, the cell size is equal to tolerance
+// so the close vertices are always in the neighbor cells
+class WeldGrid
+{
+public:
+    WeldGrid(double tolerance, size_t expectedVertices)
+        : m_tol(tolerance)
+        , m_cellSize(tolerance > 0.0 ? tolerance : 1.0)
     {
-        // can't do, return error
-        qDebug("\n\tCannot read the number of triangles (after the header)");
-        return STL_INVALID;
+        // the cells which have the same hash share the chain of vertices
+        size_t tableSize = 16;
+        while (tableSize < 2 * expectedVertices)
+            tableSize <<= 1;
+        m_tableMask = tableSize - 1;
+        m_heads.assign(tableSize, noVertex);
+        m_next.reserve(expectedVertices);
+        m_vertices.reserve(expectedVertices);
     }
 
-    // convert to int
-    uint32_t nTriangles = *reinterpret_cast<uint32_t*>(nTrianglesBytes.data());
-    // check the length of file (header + facets)
-    if (fileSize == (84 + (nTriangles * 50)))
-        // if proper return binary type
-        return STL_BINARY;
+    // return the index of welded vertex for the given point
+    uint32_t weld(const common::Vertex &p)
+    {
+        if (m_tol == 0.0)
+            return weldExact(p);
+
+        const int64_t cx = weldCellCoord(p.x, m_cellSize);
+        const int64_t cy = weldCellCoord(p.y, m_cellSize);
+        const int64_t cz = weldCellCoord(p.z, m_cellSize);
+
+        // find the first added vertex which is close to the current one,
+        // it is the same vertex as the full scan over previous vertices gives
+        uint32_t found = noVertex;
+        for (int64_t dx = -1; dx <= 1; ++dx)
+        {
+            for (int64_t dy = -1; dy <= 1; ++dy)
+            {
+                for (int64_t dz = -1; dz <= 1; ++dz)
+                {
+                    uint64_t slot = weldCellHash(cx + dx, cy + dy, cz + dz) & m_tableMask;
+                    for (uint32_t k = m_heads[slot]; k != noVertex; k = m_next[k])
+                    {
+                        if (k >= found)
+                            continue;
+                        const common::Vertex &q = m_vertices[k];
+                        // check does the distance by each axis lower than tolerance
+                        double distX = fabs(p.x - q.x);
+                        double distY = fabs(p.y - q.y);
+                        double distZ = fabs(p.z - q.z);
+                        if ((distX < m_tol || distX == 0.0) &&
+                            (distY < m_tol || distY == 0.0) &&
+                            (distZ < m_tol || distZ == 0.0))
+                            found = k;
+                    }
+                }
+            }
+        }
+
+        // the current vertex is not close to any existing
+        if (found == noVertex)
+        {
+            found = static_cast<uint32_t>(m_vertices.size());
+            uint64_t slot = weldCellHash(cx, cy, cz) & m_tableMask;
+            m_next.push_back(m_heads[slot]);
+            m_heads[slot] = found;
+            m_vertices.push_back(p);
+        }
+        return found;
+    }
+
+    inline std::vector<common::Vertex> &vertices() {return m_vertices;}
+
+private:
+    // the equal points only, they are hashed by their bits (the cells of zero tolerance
+    // would put the small model into one cell)
+    uint32_t weldExact(const common::Vertex &p)
+    {
+        // -0.0 + 0.0 is 0.0, so both zeros have the same bits
+        const double x = p.x + 0.0;
+        const double y = p.y + 0.0;
+        const double z = p.z + 0.0;
+        int64_t bits[3];
+        memcpy(&bits[0], &x, sizeof(double));
+        memcpy(&bits[1], &y, sizeof(double));
+        memcpy(&bits[2], &z, sizeof(double));
+        const uint64_t slot = weldCellHash(bits[0], bits[1], bits[2]) & m_tableMask;
+        // the chain goes from the last added vertex, the first equal one is kept
+        uint32_t found = noVertex;
+        for (uint32_t k = m_heads[slot]; k != noVertex; k = m_next[k])
+        {
+            const common::Vertex &q = m_vertices[k];
+            if (p.x == q.x && p.y == q.y && p.z == q.z)
+                found = k;
+        }
+        if (found == noVertex)
+        {
+            found = static_cast<uint32_t>(m_vertices.size());
+            m_next.push_back(m_heads[slot]);
+            m_heads[slot] = found;
+            m_vertices.push_back(p);
+        }
+        return found;
+    }
+
+    double m_tol;
+    double m_cellSize;
+    uint64_t m_tableMask;
+    std::vector<uint32_t> m_heads;
+    std::vector<uint32_t> m_next;
+    std::vector<common::Vertex> m_vertices;
+};
 
-    // not proper, return error
-    return STL_INVALID;
 }
 
-// open STL asci file format
-bool openStlAsc(char *filename, std::vector<common::Vertex> &vertices,
-                std::vector<common::Triangle> &faces)
+// the number of facets welded locally before merging into the whole mesh;
+// it is fixed (not depends on the number of threads) to keep the result the same
+#define WELD_BLOCK_TRIANGLES 65536
+
+bool weldVertices(const std::vector<common::Vertex> &soup, const WeldTolerance &tolerance,
+                  std::vector<common::Vertex> &vertices, std::vector<common::Triangle> &faces,
+                  unsigned threads, LoadControl *control)
 {
     // input variables:
-    // filename - the path of file to load
+    // soup - the vertices of triangles, 3 vertices per triangle
+    // threads - the number of threads to use (0 - all cores)
+    // control - the progress and cancellation of loading (optional)
+
+    const double tol = weldToleranceValue(soup, tolerance);
+    const size_t nTriangles = soup.size() / 3;
+    const size_t nBlocks = (nTriangles + WELD_BLOCK_TRIANGLES - 1) / WELD_BLOCK_TRIANGLES;
+
+    // remove the exact duplicates inside of each block in parallel, the tolerance is
+    // not used here: a point welded to a local vertex could miss an earlier global
+    // one close to it, while an exact duplicate always gets the vertex of its first copy
+    std::vector<std::vector<common::Vertex>> blockVertices(nBlocks);
+    std::vector<uint32_t> indices(3 * nTriangles);
+    parallelFor(nBlocks, [&](size_t begin, size_t end)
+    {
+        for (size_t iBlock = begin; iBlock < end; ++iBlock)
+        {
+            if (control != nullptr && control->isCancelled())
+                return;
+            size_t first = 3 * iBlock * WELD_BLOCK_TRIANGLES;
+            size_t last = std::min(first + 3 * WELD_BLOCK_TRIANGLES, 3 * nTriangles);
+            WeldGrid grid(0.0, last - first);
+            for (size_t i = first; i < last; ++i)
+                indices[i] = grid.weld(soup[i]);
+            std::swap(blockVertices[iBlock], grid.vertices());
+        }
+    }, 1, threads);
 
-    // open the file
-    std::ifstream obj(filename, std::ios::in);
-    // define the maximum size of line to process
-    const int buffsize = 100;
-    char str[buffsize];
+    if (control != nullptr && control->isCancelled())
+        return false;
 
-    // read the first line
-    obj.getline(str, buffsize);
+    // weld the local vertices of blocks (in the order of their first copies) into the whole
+    // mesh by the tolerance, it gives the same vertices as the ordered scan of all points
+    size_t nLocal = 0;
+    for (const auto &local : blockVertices)
+        nLocal += local.size();
 
-    // loop over the lines of file
-    while (obj.getline(str, buffsize))
+    WeldGrid grid(tol, nLocal);
+    std::vector<std::vector<uint32_t>> blockRemap(nBlocks);
+    for (size_t iBlock = 0; iBlock < nBlocks; ++iBlock)
     {
-        QString tstr = QString(str).trimmed().toLower();
-        // check do we find the start of new facet
-        if (tstr.left(5) == "facet")
+        if (control != nullptr)
         {
-            // initiate the new facet
-            unsigned int index[3];
-            // skip the line with normal data
-            obj.getline(str, buffsize);
+            if (control->isCancelled())
+                return false;
+            control->report(LoadControl::Weld, iBlock, nBlocks);
+        }
+        std::vector<common::Vertex> &local = blockVertices[iBlock];
+        blockRemap[iBlock].resize(local.size());
+        for (size_t i = 0; i < local.size(); ++i)
+            blockRemap[iBlock][i] = grid.weld(local[i]);
+        std::vector<common::Vertex>().swap(local);
+    }
+    std::swap(vertices, grid.vertices());
 
-            // loop over facet's vertices
-            for (int j = 0; j < 3; j++)
+    // set the global indices into facets
+    faces.assign(nTriangles, {0, 0, 0});
+    parallelFor(nBlocks, [&](size_t begin, size_t end)
+    {
+        for (size_t iBlock = begin; iBlock < end; ++iBlock)
+        {
+            const std::vector<uint32_t> &remap = blockRemap[iBlock];
+            size_t first = iBlock * WELD_BLOCK_TRIANGLES;
+            size_t last = std::min(first + WELD_BLOCK_TRIANGLES, nTriangles);
+            for (size_t i = first; i < last; ++i)
             {
-                // read the line with vertex data
-                obj.getline(str, buffsize);
-                tstr = QString(str).trimmed().toLower();
+                faces[i] = {remap[indices[3*i]],
+                            remap[indices[3*i + 1]],
+                            remap[indices[3*i + 2]]};
+            }
+        }
+    }, 1, threads);
+    return true;
+}
 
-                // split the buffer by spaces
-                QStringList entities = tstr.split(' ');
-                if (entities.size() != 4 || entities[0] != "vertex")
-                    return false;
+namespace {
 
-                bool ok[3];
-                double x = entities[1].toDouble(&ok[0]);
-                double y = entities[2].toDouble(&ok[1]);
-                double z = entities[3].toDouble(&ok[2]);
-                if (!ok[0] || !ok[1] || !ok[2])
-                    return false;
+inline bool isAsciiSpace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f' || c == '\v';
+}
 
-                // initiate the checker of the vertex is already exist
-                bool found_close_point = false;
-                // loop over previous vertices
-                for (size_t k = 0; k < vertices.size(); k++)
-                {
-                    // check does the distance by X axis lower than eps (little constant)
-                    double dx = abs(x - vertices[k].x);
-                    if (dx < 1E-5)
-                    {
-                        // check does the distance by Y axis lower than eps (little constant)
-                        double dy = abs(y - vertices[k].y);
-                        if (dy < 1E-5)
-                        {
-                            // check does the distance by Z axis lower than eps (little constant)
-                            double dz = abs(z - vertices[k].z);
-                            if (dz < 1E-5)
-                            {
-                                // the current vertex is close to existing one, set it into facet
-                                index[j] = static_cast<unsigned int>(k);
-                                found_close_point = true;
-                                break;
-                            }
-                        }
-                    }
-                }
+// the sequence of whitespace separated tokens over the raw bytes
+class AsciiTokenizer
+{
+public:
+    AsciiTokenizer(const char *begin, const char *end) : m_pos(begin), m_end(end) {}
 
-                // the current vertex is not close to any existing
-                if (!found_close_point)
-                {
-                    // set the index of new vertex into facet
-                    index[j] = static_cast<unsigned int>(vertices.size());
-                    // add it to array
-                    vertices.push_back({x, y, z});
-                }
+    // get the next token, return false at the end of bytes
+    bool next(const char *&tokenBegin, const char *&tokenEnd)
+    {
+        while (m_pos < m_end && isAsciiSpace(*m_pos))
+            ++m_pos;
+        if (m_pos == m_end)
+            return false;
+        tokenBegin = m_pos;
+        while (m_pos < m_end && !isAsciiSpace(*m_pos))
+            ++m_pos;
+        tokenEnd = m_pos;
+        return true;
+    }
+
+    // skip the rest of current line
+    void skipLine()
+    {
+        while (m_pos < m_end && *m_pos != '\n')
+            ++m_pos;
+    }
+
+private:
+    const char *m_pos;
+    const char *m_end;
+};
+
+// compare the token with lower case word ignoring the case
+inline bool tokenIs(const char *begin, const char *end, const char *word)
+{
+    for (; begin < end; ++begin, ++word)
+    {
+        char c = *begin;
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        if (*word == '\0' || c != *word)
+            return false;
+    }
+    return *word == '\0';
+}
+
+// parse the whole token as a number
+inline bool parseNumber(const char *begin, const char *end, double &value)
+{
+    // 'from_chars' doesn't accept the leading plus
+    if (begin < end && *begin == '+')
+        ++begin;
+    std::from_chars_result res = std::from_chars(begin, end, value);
+    return res.ec == std::errc() && res.ptr == end;
+}
+
+// find the start of the first 'facet' token at or after the given position
+const char *findFacetStart(const char *begin, const char *pos, const char *end)
+{
+    for (; pos + 5 <= end; ++pos)
+    {
+        if ((*pos | 0x20) != 'f' || (pos != begin && !isAsciiSpace(pos[-1])))
+            continue;
+        if (tokenIs(pos, std::find_if(pos, end, isAsciiSpace), "facet"))
+            return pos;
+    }
+    return end;
+}
+
+// parse the facets of ascii STL placed in the range of bytes
+bool parseStlAscRange(const char *begin, const char *end, std::vector<common::Vertex> &soup,
+                      LoadControl *control, bool reportProgress)
+{
+    AsciiTokenizer tokenizer(begin, end);
+    const char *tokBegin;
+    const char *tokEnd;
+    bool inFacet = false;
+    int nVertices = 0;
+    while (tokenizer.next(tokBegin, tokEnd))
+    {
+        if (tokenIs(tokBegin, tokEnd, "facet"))
+        {
+            // the previous facet is not finished
+            if (inFacet)
+                return false;
+            inFacet = true;
+            nVertices = 0;
+        }
+        else if (tokenIs(tokBegin, tokEnd, "vertex"))
+        {
+            if (!inFacet || nVertices == 3)
+                return false;
+
+            double coords[3];
+            for (double &coord : coords)
+            {
+                if (!tokenizer.next(tokBegin, tokEnd) || !parseNumber(tokBegin, tokEnd, coord))
+                    return false;
             }
+            soup.push_back({coords[0], coords[1], coords[2]});
+            ++nVertices;
 
-            // add new facet into array
-            faces.push_back({index[0], index[1], index[2]});
-            // skip the end of facet
-            obj.getline(str, buffsize);
-            obj.getline(str, buffsize);
+            // check the cancellation from time to time
+            if (control != nullptr && (soup.size() & 0xFFFF) == 0)
+            {
+                if (control->isCancelled())
+                    return false;
+                if (reportProgress)
+                    control->report(LoadControl::Parse, tokEnd - begin, end - begin);
+            }
+        }
+        else if (tokenIs(tokBegin, tokEnd, "endfacet"))
+        {
+            if (!inFacet || nVertices != 3)
+                return false;
+            inFacet = false;
         }
+        else if (tokenIs(tokBegin, tokEnd, "solid") || tokenIs(tokBegin, tokEnd, "endsolid"))
+        {
+            // the name of solid can be any text
+            tokenizer.skipLine();
+        }
+        // all other tokens (normal, outer loop, endloop and numbers) are skipped
     }
+    return !inFacet;
+}
 
-    return true;
 }
 
-// convert binary STL to OFF
-bool openStlBin(char *filename, std::vector<common::Vertex> &vertices,
-                std::vector<common::Triangle> &faces)
+// the minimum number of bytes of ascii STL to parse in a separate thread
+#define ASCII_CHUNK_BYTES (4 << 20)
+
+// open STL asci file format
+bool openStlAsc(const MappedFile &file, std::vector<common::Vertex> &vertices,
+                std::vector<common::Triangle> &faces, const WeldTolerance &tolerance,
+                unsigned threads, LoadControl *control)
 {
     // input variables:
-    // filename - the path of file to load
+    // file - the mapped file to load, the tokens are read directly from the mapping
+    // tolerance - the distance to merge the close vertices
+    // threads - the number of threads to use (0 - all cores)
+    // control - the progress and cancellation of loading (optional)
+
+    file.adviseSequential();
+
+    const char *begin = reinterpret_cast<const char*>(file.data());
+    const char *end = begin + file.size();
+
+    // split the file into the chunks which start at 'facet' tokens
+    size_t nChunks = std::max<size_t>(1, std::min<size_t>(workerThreads(threads),
+                                                          file.size() / ASCII_CHUNK_BYTES));
+    std::vector<const char*> bounds(nChunks + 1, end);
+    bounds[0] = begin;
+    for (size_t i = 1; i < nChunks; ++i)
+        bounds[i] = findFacetStart(begin, std::max(bounds[i - 1], begin + i * (file.size() / nChunks)), end);
+
+    // parse the chunks in parallel
+    std::vector<std::vector<common::Vertex>> chunkSoup(nChunks);
+    std::vector<char> chunkOk(nChunks, 0);
+    parallelFor(nChunks, [&](size_t first, size_t last)
+    {
+        for (size_t i = first; i < last; ++i)
+            // the first chunk is parsed by the calling thread, it reports the progress
+            chunkOk[i] = parseStlAscRange(bounds[i], bounds[i + 1], chunkSoup[i], control, i == 0);
+    }, 1, threads);
 
-    // open the file
-    std::ifstream obj(filename, std::ios::in | std::ios::binary);
-    // skip the header
-    for (int i = 0; i < 80; i++) {
-        uint8_t c;
-        obj.read(reinterpret_cast<char*>(&c), sizeof(c));
+    // the vertices of facets before welding
+    std::vector<common::Vertex> soup;
+    size_t soupSize = 0;
+    for (size_t i = 0; i < nChunks; ++i)
+    {
+        if (!chunkOk[i])
+            return false;
+        soupSize += chunkSoup[i].size();
+    }
+    soup.reserve(soupSize);
+    for (std::vector<common::Vertex> &chunk : chunkSoup)
+    {
+        soup.insert(soup.end(), chunk.begin(), chunk.end());
+        std::vector<common::Vertex>().swap(chunk);
+    }
+
+    if (control != nullptr)
+    {
+        if (control->isCancelled())
+            return false;
+        control->soupLoaded(soup);
     }
 
-    // read the number of facets
+    // merge the close vertices
+    return weldVertices(soup, tolerance, vertices, faces, threads, control);
+}
+
+// convert binary STL to OFF
+bool openStlBin(const MappedFile &file, std::vector<common::Vertex> &vertices,
+                std::vector<common::Triangle> &faces, const WeldTolerance &tolerance,
+                unsigned threads, LoadControl *control)
+{
+    // input variables:
+    // file - the mapped file to load, the facets are read directly from the mapping
+    // tolerance - the distance to merge the close vertices
+    // threads - the number of threads to use (0 - all cores)
+    // control - the progress and cancellation of loading (optional)
+
+    file.adviseSequential();
+
+    // check the file keeps the header and the number of facets
+    if (file.size() < 84)
+        return false;
+
+    // read the number of facets (after the header)
+    const uchar *data = file.data();
     uint32_t N32;
-    obj.read(reinterpret_cast<char*>(&N32), sizeof(N32));
-    unsigned int N = N32;
+    memcpy(&N32, data + 80, sizeof(N32));
+    const uint64_t N = N32;
+
+    // check the file keeps all the facets (50 bytes per facet)
+    if (file.size() < 84 + N * 50)
+        return false;
 
-    // initiate the arrays of vertices and facets
-    faces.reserve(N);
+    // the vertices of facets before welding
+    std::vector<common::Vertex> soup(3 * N);
 
-    // loop over facets
-    for (unsigned int i = 0; i < N; i++) {
-        // initiate the new normal
-        float normal[3];
-        // read the floats (normal coordinates) from binary
-        obj.read(reinterpret_cast<char*>(normal), sizeof(normal));
-
-        // initiate the new facet
-        unsigned int index[3];
-        // loop over facet's vertices
-        for (int j = 0; j < 3; j++) {
-            // read the floats (vertex coordinates) from binary
-            float coords[3];
-            obj.read(reinterpret_cast<char*>(coords), sizeof(coords));
-
-            // initiate the checker of the vertex is already exist
-            bool found_close_point = false;
-            // loop over previous vertices
-            for (size_t k = 0; k < vertices.size(); k++) {
-                // check does the distance by X axis lower than eps (little constant)
-                double dx = abs(static_cast<double>(coords[0]) - vertices[k].x);
-                if (dx < 1E-5) {
-                    // check does the distance by Y axis lower than eps (little constant)
-                    double dy = abs(static_cast<double>(coords[1]) - vertices[k].y);
-                    if (dy < 1E-5) {
-                        // check does the distance by Z axis lower than eps (little constant)
-                        double dz = abs(static_cast<double>(coords[2]) - vertices[k].z);
-                        if (dz < 1E-5) {
-                            // the current vertex is close to existing one, set it into facet
-                            index[j] = static_cast<unsigned int>(k);
-                            found_close_point = true;
-                            break;
-                        }
-                    }
-                }
+    // decode the ranges of facets in parallel, the records have fixed size
+    parallelFor(N, [&](size_t begin, size_t end)
+    {
+        const uchar *facet = data + 84 + 50 * begin;
+        for (size_t i = begin; i < end; ++i, facet += 50) {
+            // check the cancellation from time to time
+            if (control != nullptr && (i & 0xFFFF) == 0)
+            {
+                if (control->isCancelled())
+                    return;
+                // the first range is decoded by the calling thread
+                if (begin == 0)
+                    control->report(LoadControl::Parse, i, end);
             }
+            // read the floats (vertex coordinates) skipping the normal
+            float coords[9];
+            memcpy(coords, facet + 12, sizeof(coords));
+            soup[3*i    ] = coords;
+            soup[3*i + 1] = coords + 3;
+            soup[3*i + 2] = coords + 6;
+        }
+    }, 65536, threads);
 
-            // the current vertex is not close to any existing
-            if (!found_close_point) {
-                // set the index of new vertex into facet
-                index[j] = static_cast<unsigned int>(vertices.size());
-                // add it to array
-                vertices.push_back(coords);
-            }
+    if (control != nullptr)
+    {
+        if (control->isCancelled())
+            return false;
+        control->soupLoaded(soup);
+    }
+
+    // merge the close vertices
+    return weldVertices(soup, tolerance, vertices, faces, threads, control);
+}
+
+namespace {
+
+// parse the whole token as an integer
+inline bool parseInteger(const char *begin, const char *end, int64_t &value)
+{
+    if (begin < end && *begin == '+')
+        ++begin;
+    std::from_chars_result res = std::from_chars(begin, end, value);
+    return res.ec == std::errc() && res.ptr == end;
+}
+
+// convert the OBJ index (1-based or negative relative) into 0-based
+inline bool objIndex(const char *begin, const char *end, size_t nVertices, uint32_t &index)
+{
+    // the vertex index is before the first slash (v/vt/vn)
+    const char *slash = std::find(begin, end, '/');
+    int64_t value;
+    if (!parseInteger(begin, slash, value) || value == 0)
+        return false;
+    if (value < 0)
+        value += static_cast<int64_t>(nVertices);
+    else
+        value -= 1;
+    if (value < 0 || static_cast<uint64_t>(value) >= nVertices)
+        return false;
+    index = static_cast<uint32_t>(value);
+    return true;
+}
+
+// the scalar types of PLY properties
+enum PlyType {PlyInvalid, PlyInt8, PlyUInt8, PlyInt16, PlyUInt16,
+              PlyInt32, PlyUInt32, PlyFloat32, PlyFloat64};
+
+PlyType plyType(const char *begin, const char *end)
+{
+    if (tokenIs(begin, end, "char") || tokenIs(begin, end, "int8"))
+        return PlyInt8;
+    if (tokenIs(begin, end, "uchar") || tokenIs(begin, end, "uint8"))
+        return PlyUInt8;
+    if (tokenIs(begin, end, "short") || tokenIs(begin, end, "int16"))
+        return PlyInt16;
+    if (tokenIs(begin, end, "ushort") || tokenIs(begin, end, "uint16"))
+        return PlyUInt16;
+    if (tokenIs(begin, end, "int") || tokenIs(begin, end, "int32"))
+        return PlyInt32;
+    if (tokenIs(begin, end, "uint") || tokenIs(begin, end, "uint32"))
+        return PlyUInt32;
+    if (tokenIs(begin, end, "float") || tokenIs(begin, end, "float32"))
+        return PlyFloat32;
+    if (tokenIs(begin, end, "double") || tokenIs(begin, end, "float64"))
+        return PlyFloat64;
+    return PlyInvalid;
+}
+
+inline size_t plyTypeSize(PlyType type)
+{
+    static const size_t sizes[] = {0, 1, 1, 2, 2, 4, 4, 4, 8};
+    return sizes[type];
+}
+
+// read the binary scalar converting the byte order if needed
+inline double plyRead(const uchar *data, PlyType type, bool bigEndian)
+{
+    uchar bytes[8];
+    size_t size = plyTypeSize(type);
+    if (bigEndian)
+        std::reverse_copy(data, data + size, bytes);
+    else
+        memcpy(bytes, data, size);
+
+    switch (type)
+    {
+    case PlyInt8:    {int8_t v;   memcpy(&v, bytes, 1); return v;}
+    case PlyUInt8:   {uint8_t v;  memcpy(&v, bytes, 1); return v;}
+    case PlyInt16:   {int16_t v;  memcpy(&v, bytes, 2); return v;}
+    case PlyUInt16:  {uint16_t v; memcpy(&v, bytes, 2); return v;}
+    case PlyInt32:   {int32_t v;  memcpy(&v, bytes, 4); return v;}
+    case PlyUInt32:  {uint32_t v; memcpy(&v, bytes, 4); return v;}
+    case PlyFloat32: {float v;    memcpy(&v, bytes, 4); return static_cast<double>(v);}
+    case PlyFloat64: {double v;   memcpy(&v, bytes, 8); return v;}
+    default: return 0.0;
+    }
+}
+
+struct PlyProperty
+{
+    PlyType type = PlyInvalid;
+    PlyType countType = PlyInvalid; // the type of list length (for the list properties)
+    bool isList = false;
+    std::string name;
+};
+
+struct PlyElement
+{
+    std::string name;
+    uint64_t count = 0;
+    std::vector<PlyProperty> properties;
+};
+
+}
+
+// open OBJ file format (the vertices are indexed already, no welding needed)
+bool openObj(const MappedFile &file, std::vector<common::Vertex> &vertices,
+             std::vector<common::Triangle> &faces, LoadControl *control)
+{
+    // input variables:
+    // file - the mapped file to load
+    // control - the progress and cancellation of loading (optional)
+
+    file.adviseSequential();
+    vertices.clear();
+    faces.clear();
+
+    const char *begin = reinterpret_cast<const char*>(file.data());
+    const char *end = begin + file.size();
+    std::vector<uint32_t> polygon;
+    uint64_t nLines = 0;
+
+    // loop over the lines of file
+    for (const char *line = begin; line < end; )
+    {
+        const char *lineEnd = std::find(line, end, '\n');
+        AsciiTokenizer tokenizer(line, lineEnd);
+        line = lineEnd + (lineEnd < end ? 1 : 0);
+
+        // check the cancellation from time to time
+        if (control != nullptr && (++nLines & 0xFFFF) == 0)
+        {
+            if (control->isCancelled())
+                return false;
+            control->report(LoadControl::Read, line - begin, end - begin);
         }
 
-        // add new facet into array
-        faces.push_back({index[0], index[1], index[2]});
-        // skip the end of facet
-        char c[2];
-        obj.read(reinterpret_cast<char*>(c), sizeof(c));
+        const char *tokBegin;
+        const char *tokEnd;
+        if (!tokenizer.next(tokBegin, tokEnd))
+            continue;
+
+        if (tokEnd - tokBegin == 1 && *tokBegin == 'v')
+        {
+            // the vertex: v x y z [w]
+            double coords[3];
+            for (double &coord : coords)
+            {
+                if (!tokenizer.next(tokBegin, tokEnd) || !parseNumber(tokBegin, tokEnd, coord))
+                    return false;
+            }
+            vertices.push_back({coords[0], coords[1], coords[2]});
+        }
+        else if (tokEnd - tokBegin == 1 && *tokBegin == 'f')
+        {
+            // the polygon: f v1[/vt1[/vn1]] v2... , triangulate it by fan
+            polygon.clear();
+            while (tokenizer.next(tokBegin, tokEnd))
+            {
+                uint32_t index;
+                if (!objIndex(tokBegin, tokEnd, vertices.size(), index))
+                    return false;
+                polygon.push_back(index);
+            }
+            if (polygon.size() < 3)
+                return false;
+            for (size_t i = 1; i + 1 < polygon.size(); ++i)
+                faces.push_back({polygon[0], polygon[i], polygon[i + 1]});
+        }
+        // all other records (normals, texture coordinates, groups, materials) are skipped
     }
 
     return true;
 }
 
+// open binary (little or big endian) PLY file format, the vertices are indexed already
+bool openPly(const MappedFile &file, std::vector<common::Vertex> &vertices,
+             std::vector<common::Triangle> &faces, LoadControl *control)
+{
+    // input variables:
+    // file - the mapped file to load
+    // control - the progress and cancellation of loading (optional)
+
+    file.adviseSequential();
+    vertices.clear();
+    faces.clear();
+
+    const char *begin = reinterpret_cast<const char*>(file.data());
+    const char *end = begin + file.size();
+    if (file.size() < 4 || memcmp(begin, "ply", 3) != 0)
+        return false;
+
+    // parse the header
+    bool bigEndian = false;
+    bool formatFound = false;
+    std::vector<PlyElement> elements;
+    const char *line = begin;
+    const char *body = nullptr;
+    while (line < end && body == nullptr)
+    {
+        const char *lineEnd = std::find(line, end, '\n');
+        AsciiTokenizer tokenizer(line, lineEnd);
+        line = lineEnd + (lineEnd < end ? 1 : 0);
+
+        const char *tokBegin;
+        const char *tokEnd;
+        if (!tokenizer.next(tokBegin, tokEnd))
+            continue;
+
+        if (tokenIs(tokBegin, tokEnd, "format"))
+        {
+            if (!tokenizer.next(tokBegin, tokEnd))
+                return false;
+            if (tokenIs(tokBegin, tokEnd, "binary_big_endian"))
+                bigEndian = true;
+            else if (!tokenIs(tokBegin, tokEnd, "binary_little_endian"))
+                return false; // the ascii PLY isn't supported
+            formatFound = true;
+        }
+        else if (tokenIs(tokBegin, tokEnd, "element"))
+        {
+            PlyElement element;
+            int64_t count;
+            if (!tokenizer.next(tokBegin, tokEnd))
+                return false;
+            element.name.assign(tokBegin, tokEnd);
+            if (!tokenizer.next(tokBegin, tokEnd) || !parseInteger(tokBegin, tokEnd, count) || count < 0)
+                return false;
+            element.count = static_cast<uint64_t>(count);
+            elements.push_back(element);
+        }
+        else if (tokenIs(tokBegin, tokEnd, "property"))
+        {
+            if (elements.empty() || !tokenizer.next(tokBegin, tokEnd))
+                return false;
+            PlyProperty property;
+            if (tokenIs(tokBegin, tokEnd, "list"))
+            {
+                property.isList = true;
+                if (!tokenizer.next(tokBegin, tokEnd))
+                    return false;
+                property.countType = plyType(tokBegin, tokEnd);
+                if (property.countType == PlyInvalid || !tokenizer.next(tokBegin, tokEnd))
+                    return false;
+            }
+            property.type = plyType(tokBegin, tokEnd);
+            if (property.type == PlyInvalid || !tokenizer.next(tokBegin, tokEnd))
+                return false;
+            property.name.assign(tokBegin, tokEnd);
+            elements.back().properties.push_back(property);
+        }
+        else if (tokenIs(tokBegin, tokEnd, "end_header"))
+        {
+            body = line;
+        }
+        // the comments and obj_info are skipped
+    }
+    if (body == nullptr || !formatFound)
+        return false;
+
+    // read the elements
+    const uchar *pos = reinterpret_cast<const uchar*>(body);
+    const uchar *dataEnd = file.data() + file.size();
+    std::vector<uint32_t> polygon;
+    for (const PlyElement &element : elements)
+    {
+        const bool isVertex = element.name == "vertex";
+        const bool isFace = element.name == "face";
+
+        // find the properties which are used
+        int propX = -1, propY = -1, propZ = -1, propIndices = -1;
+        for (size_t i = 0; i < element.properties.size(); ++i)
+        {
+            const PlyProperty &property = element.properties[i];
+            if (isVertex && !property.isList && property.name == "x")
+                propX = static_cast<int>(i);
+            if (isVertex && !property.isList && property.name == "y")
+                propY = static_cast<int>(i);
+            if (isVertex && !property.isList && property.name == "z")
+                propZ = static_cast<int>(i);
+            if (isFace && property.isList &&
+                (property.name == "vertex_indices" || property.name == "vertex_index"))
+                propIndices = static_cast<int>(i);
+        }
+        if (isVertex && (propX < 0 || propY < 0 || propZ < 0))
+            return false;
+        // the records without properties have no data
+        if (element.properties.empty())
+            continue;
+
+        // the count of damaged header is limited by the smallest records in the rest of file
+        size_t minRecordSize = 0;
+        for (const PlyProperty &property : element.properties)
+            minRecordSize += plyTypeSize(property.isList ? property.countType : property.type);
+        const uint64_t maxRecords = static_cast<uint64_t>(dataEnd - pos) / minRecordSize;
+        if (element.count > maxRecords)
+            return false;
+        if (isVertex)
+            vertices.reserve(element.count);
+        if (isFace)
+            faces.reserve(element.count);
+
+        for (uint64_t iRecord = 0; iRecord < element.count; ++iRecord)
+        {
+            // check the cancellation from time to time
+            if (control != nullptr && (iRecord & 0xFFFF) == 0)
+            {
+                if (control->isCancelled())
+                    return false;
+                control->report(LoadControl::Read, pos - file.data(), file.size());
+            }
+
+            double coords[3] = {0.0, 0.0, 0.0};
+            for (size_t i = 0; i < element.properties.size(); ++i)
+            {
+                const PlyProperty &property = element.properties[i];
+                if (!property.isList)
+                {
+                    size_t size = plyTypeSize(property.type);
+                    if (static_cast<size_t>(dataEnd - pos) < size)
+                        return false;
+                    if (static_cast<int>(i) == propX)
+                        coords[0] = plyRead(pos, property.type, bigEndian);
+                    else if (static_cast<int>(i) == propY)
+                        coords[1] = plyRead(pos, property.type, bigEndian);
+                    else if (static_cast<int>(i) == propZ)
+                        coords[2] = plyRead(pos, property.type, bigEndian);
+                    pos += size;
+                    continue;
+                }
+
+                // the list property: the length and the items
+                size_t countSize = plyTypeSize(property.countType);
+                if (static_cast<size_t>(dataEnd - pos) < countSize)
+                    return false;
+                double count = plyRead(pos, property.countType, bigEndian);
+                pos += countSize;
+                // the length of float type can be anything, it's checked before the conversion
+                size_t itemSize = plyTypeSize(property.type);
+                if (!isfinite(count) || count < 0 || count != floor(count) ||
+                    count > static_cast<double>((dataEnd - pos) / itemSize))
+                    return false;
+                size_t listSize = static_cast<size_t>(count) * itemSize;
+                if (static_cast<size_t>(dataEnd - pos) < listSize)
+                    return false;
+
+                if (static_cast<int>(i) == propIndices)
+                {
+                    // triangulate the polygon by fan
+                    polygon.resize(static_cast<size_t>(count));
+                    for (size_t k = 0; k < polygon.size(); ++k)
+                    {
+                        double index = plyRead(pos + k * itemSize, property.type, bigEndian);
+                        if (!(index >= 0 && index < static_cast<double>(vertices.size())) ||
+                            index != floor(index))
+                            return false;
+                        polygon[k] = static_cast<uint32_t>(index);
+                    }
+                    if (polygon.size() < 3)
+                        return false;
+                    for (size_t k = 1; k + 1 < polygon.size(); ++k)
+                        faces.push_back({polygon[0], polygon[k], polygon[k + 1]});
+                }
+                pos += listSize;
+            }
+
+            if (isVertex)
+                vertices.push_back({coords[0], coords[1], coords[2]});
+        }
+    }
+
+    return true;
+}
+
+bool loadModel(const QString &path, std::vector<common::Vertex> &vertices,
+               std::vector<common::Triangle> &faces, QString &error,
+               const WeldTolerance &tolerance, LoadControl *control)
+{
+    // input variables:
+    // path - the path of file to load
+    // tolerance - the tolerance to weld the vertices of STL facets
+    // control - the progress and cancellation of loading (optional)
+
+    // map the file once, it is read only by the detection and the loader
+    MappedFile file;
+    if (!file.open(path))
+    {
+        error = "The file cannot be opened";
+        return false;
+    }
+
+    // the indexed formats are defined by extension
+    bool ok;
+    if (QString::compare(path.right(5), ".cmsh", Qt::CaseInsensitive) == 0)
+    {
+        ok = openCompressedMesh(file, vertices, faces, control);
+        if (control != nullptr && control->isCancelled())
+        {
+            error.clear();
+            return false;
+        }
+        if (!ok || faces.empty())
+        {
+            error = "The file is corrupt and cannot be loaded";
+            return false;
+        }
+        return true;
+    }
+
+    QString ext = path.right(4);
+    if (QString::compare(ext, ".obj", Qt::CaseInsensitive) == 0 ||
+        QString::compare(ext, ".ply", Qt::CaseInsensitive) == 0)
+    {
+        bool isObj = QString::compare(ext, ".obj", Qt::CaseInsensitive) == 0;
+        ok = isObj ? openObj(file, vertices, faces, control) : openPly(file, vertices, faces, control);
+        if (control != nullptr && control->isCancelled())
+        {
+            error.clear();
+            return false;
+        }
+        if (!ok || faces.empty())
+        {
+            error = QString("this %1 file has incorrect or unsupported format").arg(isObj ? "OBJ" : "PLY");
+            return false;
+        }
+        return true;
+    }
+
+    // check the type of STL (ascii or binary)
+    int type = getStlFileFormat(file);
+    if (type == STL_BINARY)
+    {
+        ok = openStlBin(file, vertices, faces, tolerance, 0, control);
+    }
+    else if (type == STL_ASCII)
+    {
+        ok = openStlAsc(file, vertices, faces, tolerance, 0, control);
+    }
+    else
+    {
+        error = "The file is corrupt and cannot be loaded";
+        return false;
+    }
+
+    if (control != nullptr && control->isCancelled())
+    {
+        // no error message for the cancelled loading
+        error.clear();
+        return false;
+    }
+    if (!ok)
+    {
+        error = "this STL file has incorrect format";
+        return false;
+    }
+    return true;
+}
+
+void LoadControl::report(Stage stage, uint64_t done, uint64_t total) const
+{
+    if (!progress || total == 0)
+        return;
+
+    // the parsing takes the first part of loading, the welding takes the rest,
+    // the indexed formats are only read
+    int first = stage == Weld ? 40 : 0;
+    int last = stage == Parse ? 40 : 100;
+    progress(first + static_cast<int>((last - first) * done / total));
+}
+
+void LoadControl::soupLoaded(const std::vector<common::Vertex> &soup) const
+{
+    if (soupReady)
+        soupReady(soup);
+}
+
+unsigned workerThreads(unsigned threads)
+{
+    if (threads > 0)
+        return threads;
+    unsigned cores = std::thread::hardware_concurrency();
+    return cores > 0 ? cores : 1;
+}
+
+void parallelFor(size_t count, const std::function<void(size_t, size_t)> &body,
+                 size_t minChunk, unsigned threads)
+{
+    if (count == 0)
+        return;
+
+    // split the range into equal parts, one per thread
+    size_t nThreads = workerThreads(threads);
+    nThreads = std::min(nThreads, (count + minChunk - 1) / std::max<size_t>(minChunk, 1));
+    if (nThreads <= 1)
+    {
+        body(0, count);
+        return;
+    }
+
+    std::vector<std::thread> pool;
+    pool.reserve(nThreads - 1);
+    size_t chunk = (count + nThreads - 1) / nThreads;
+    for (size_t i = 1; i < nThreads; ++i)
+    {
+        size_t begin = std::min(i * chunk, count);
+        size_t end = std::min(begin + chunk, count);
+        pool.emplace_back(body, begin, end);
+    }
+    // the current thread processes the first part
+    body(0, std::min(chunk, count));
+    for (std::thread &thread : pool)
+        thread.join();
+}
+
+namespace {
+
+inline std::pmr::memory_resource *memoryOrDefault(std::pmr::memory_resource *memory)
+{
+    return memory != nullptr ? memory : std::pmr::get_default_resource();
+}
+
+// the bits of radix digit to sort the edge keys
+const unsigned edgeRadixBits = 8;
+const size_t edgeRadixSize = size_t(1) << edgeRadixBits;
+
+// stable LSD radix sort of keys with their values, the lowest 'bits' of keys are sorted,
+// return false if cancelled between the passes (the order is undefined then)
+bool radixSort(std::pmr::vector<uint64_t> &keys, std::pmr::vector<uint32_t> &values,
+               unsigned bits, unsigned threads, const LoadControl *control = nullptr)
+{
+    const size_t count = keys.size();
+    const size_t nChunks = std::max<size_t>(1, std::min<size_t>(workerThreads(threads), count / 65536));
+    const size_t chunk = (count + nChunks - 1) / nChunks;
+
+    std::pmr::memory_resource *memory = keys.get_allocator().resource();
+    std::pmr::vector<uint64_t> keysTmp(count, memory);
+    std::pmr::vector<uint32_t> valuesTmp(count, memory);
+    std::pmr::vector<size_t> positions(nChunks * edgeRadixSize, memory);
+    for (unsigned shift = 0; shift < bits; shift += edgeRadixBits)
+    {
+        if (control != nullptr && control->isCancelled())
+            return false;
+
+        // count the digits in every chunk
+        std::fill(positions.begin(), positions.end(), 0);
+        parallelFor(nChunks, [&](size_t begin, size_t end)
+        {
+            for (size_t c = begin; c < end; ++c)
+            {
+                size_t *hist = &positions[c * edgeRadixSize];
+                size_t last = std::min(count, (c + 1) * chunk);
+                for (size_t i = c * chunk; i < last; ++i)
+                    ++hist[(keys[i] >> shift) & (edgeRadixSize - 1)];
+            }
+        }, 1, static_cast<unsigned>(nChunks));
+
+        // the chunks write their items of a digit one after another to keep the order
+        size_t sum = 0;
+        for (size_t d = 0; d < edgeRadixSize; ++d)
+        {
+            for (size_t c = 0; c < nChunks; ++c)
+            {
+                size_t n = positions[c * edgeRadixSize + d];
+                positions[c * edgeRadixSize + d] = sum;
+                sum += n;
+            }
+        }
+
+        parallelFor(nChunks, [&](size_t begin, size_t end)
+        {
+            for (size_t c = begin; c < end; ++c)
+            {
+                size_t *pos = &positions[c * edgeRadixSize];
+                size_t last = std::min(count, (c + 1) * chunk);
+                for (size_t i = c * chunk; i < last; ++i)
+                {
+                    size_t p = pos[(keys[i] >> shift) & (edgeRadixSize - 1)]++;
+                    keysTmp[p] = keys[i];
+                    valuesTmp[p] = values[i];
+                }
+            }
+        }, 1, static_cast<unsigned>(nChunks));
+
+        std::swap(keys, keysTmp);
+        std::swap(values, valuesTmp);
+    }
+    return true;
+}
+
+}
+
+bool buildEdges(const std::vector<common::Triangle> &triangles,
+                std::vector<common::Edge> &edges, std::vector<uint32_t> &triangleEdges,
+                unsigned threads, std::pmr::memory_resource *memory, LoadControl *control)
+{
+    // input variables:
+    // triangles - the facets of mesh
+    // threads - the number of threads (0 - the number of cores)
+    // memory - the memory of temporary arrays (the heap by default)
+    // control - the cancellation of loading (optional), the arrays stay empty if cancelled
+    //
+    // the edge is the unordered pair of vertices, the edges are numbered in the order
+    // of their first half-edges and keep the direction of them
+
+    edges.clear();
+    triangleEdges.clear();
+    const size_t count = 3 * triangles.size();
+    if (count == 0)
+        return true;
+
+    // the keys of half-edges: (min, max) packed into the bits needed by the vertex indices
+    uint32_t maxIndex = 0;
+    for (const common::Triangle &tri : triangles)
+        maxIndex = std::max({maxIndex, tri.coord[0], tri.coord[1], tri.coord[2]});
+    unsigned indexBits = 1;
+    while (indexBits < 32 && (maxIndex >> indexBits) != 0)
+        ++indexBits;
+
+    memory = memoryOrDefault(memory);
+    std::pmr::vector<uint64_t> keys(count, memory);
+    std::pmr::vector<uint32_t> halfEdges(count, memory);
+    parallelFor(triangles.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t t = begin; t < end; ++t)
+        {
+            const uint32_t *coord = triangles[t].coord;
+            for (size_t i = 0; i < 3; ++i)
+            {
+                uint64_t i1 = coord[i];
+                uint64_t i2 = coord[(i+1)%3];
+                keys[3*t + i] = i1 < i2 ? (i1 << indexBits) | i2 : (i2 << indexBits) | i1;
+                halfEdges[3*t + i] = static_cast<uint32_t>(3*t + i);
+            }
+        }
+    }, 65536, threads);
+
+    // the sort is stable, so the run of equal keys starts with the first half-edge
+    if (!radixSort(keys, halfEdges, 2 * indexBits, threads, control) ||
+        (control != nullptr && control->isCancelled()))
+        return false;
+
+    // mark the first half-edges of edges
+    std::pmr::vector<uint8_t> isFirst(count, 0, memory);
+    parallelFor(count, [&](size_t begin, size_t end)
+    {
+        for (size_t p = begin; p < end; ++p)
+            if (p == 0 || keys[p] != keys[p - 1])
+                isFirst[halfEdges[p]] = 1;
+    }, 65536, threads);
+
+    // the edge ids are the prefix sums of marks in the order of half-edges
+    const size_t nChunks = std::max<size_t>(1, std::min<size_t>(workerThreads(threads), count / 65536));
+    const size_t chunk = (count + nChunks - 1) / nChunks;
+    std::pmr::vector<uint32_t> chunkEdges(nChunks + 1, 0, memory);
+    parallelFor(nChunks, [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; ++c)
+        {
+            size_t last = std::min(count, (c + 1) * chunk);
+            uint32_t n = 0;
+            for (size_t h = c * chunk; h < last; ++h)
+                n += isFirst[h];
+            chunkEdges[c + 1] = n;
+        }
+    }, 1, static_cast<unsigned>(nChunks));
+    for (size_t c = 0; c < nChunks; ++c)
+        chunkEdges[c + 1] += chunkEdges[c];
+
+    edges.resize(chunkEdges[nChunks]);
+    triangleEdges.resize(count);
+    parallelFor(nChunks, [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; ++c)
+        {
+            size_t last = std::min(count, (c + 1) * chunk);
+            uint32_t id = chunkEdges[c];
+            for (size_t h = c * chunk; h < last; ++h)
+            {
+                if (!isFirst[h])
+                    continue;
+                const uint32_t *coord = triangles[h / 3].coord;
+                edges[id] = {coord[h % 3], coord[(h % 3 + 1) % 3]};
+                // the first half-edge keeps the id of edge until the runs are resolved
+                triangleEdges[h] = id++;
+            }
+        }
+    }, 1, static_cast<unsigned>(nChunks));
+
+    // the other half-edges of run take the id of the first one
+    parallelFor(count, [&](size_t begin, size_t end)
+    {
+        // find the start of run the range begins in
+        size_t first = begin;
+        while (first > 0 && keys[first - 1] == keys[begin])
+            --first;
+        uint32_t id = triangleEdges[halfEdges[first]];
+        for (size_t p = begin; p < end; ++p)
+        {
+            if (keys[p] != keys[first])
+            {
+                first = p;
+                id = triangleEdges[halfEdges[p]];
+            }
+            else if (p != first)
+            {
+                triangleEdges[halfEdges[p]] = id;
+            }
+        }
+    }, 65536, threads);
+    return true;
+}
+
+namespace {
+
+// the bits of every coordinate in the Morton code of triangle center
+const unsigned mortonBits = 10;
+
+// spread the lowest 10 bits of value to every third bit
+inline uint64_t spreadBits(uint64_t value)
+{
+    value &= 0x3FF;
+    value = (value | (value << 16)) & 0x30000FF;
+    value = (value | (value << 8)) & 0x300F00F;
+    value = (value | (value << 4)) & 0x30C30C3;
+    value = (value | (value << 2)) & 0x9249249;
+    return value;
+}
+
+}
+
+bool sortTrianglesSpatially(const std::vector<common::Vertex> &vertices,
+                            std::vector<common::Triangle> &triangles,
+                            unsigned threads, std::pmr::memory_resource *memory,
+                            LoadControl *control, std::vector<uint32_t> *permutation)
+{
+    // input variables:
+    // vertices - the vertices of mesh
+    // triangles - the facets to reorder
+    // threads - the number of threads (0 - the number of cores)
+    // memory - the memory of temporary arrays (the heap by default)
+    // control - the cancellation of loading (optional), the triangles keep their order if cancelled
+    // permutation - receives the source indices of sorted triangles (optional)
+    //
+    // the triangles are ordered by the Morton code of their centers in the bounding box,
+    // so the triangles close in the array are close in space too
+
+    if (triangles.size() > UINT32_MAX)
+        return true;
+    // the triangles not sorted keep their indices
+    if (permutation != nullptr)
+    {
+        permutation->resize(triangles.size());
+        for (size_t i = 0; i < triangles.size(); ++i)
+            (*permutation)[i] = static_cast<uint32_t>(i);
+    }
+    if (triangles.size() < 2)
+        return true;
+
+    common::Vertex boxMin( DBL_MAX, DBL_MAX, DBL_MAX);
+    common::Vertex boxMax(-DBL_MAX,-DBL_MAX,-DBL_MAX);
+    for (const common::Vertex &p : vertices)
+    {
+        boxMin = {std::min(boxMin.x, p.x), std::min(boxMin.y, p.y), std::min(boxMin.z, p.z)};
+        boxMax = {std::max(boxMax.x, p.x), std::max(boxMax.y, p.y), std::max(boxMax.z, p.z)};
+    }
+    const double cells = static_cast<double>((1u << mortonBits) - 1);
+    auto cellScale = [cells](double extent)
+    {
+        return extent > DBL_EPSILON ? cells / extent : 0.0;
+    };
+    const common::Vertex scale(cellScale(boxMax.x - boxMin.x),
+                               cellScale(boxMax.y - boxMin.y),
+                               cellScale(boxMax.z - boxMin.z));
+
+    memory = memoryOrDefault(memory);
+    std::pmr::vector<uint64_t> keys(triangles.size(), memory);
+    std::pmr::vector<uint32_t> order(triangles.size(), memory);
+    parallelFor(triangles.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t t = begin; t < end; ++t)
+        {
+            const uint32_t *coord = triangles[t].coord;
+            common::Vertex center = (vertices[coord[0]] + vertices[coord[1]] + vertices[coord[2]]) / 3;
+            uint64_t x = static_cast<uint64_t>((center.x - boxMin.x) * scale.x);
+            uint64_t y = static_cast<uint64_t>((center.y - boxMin.y) * scale.y);
+            uint64_t z = static_cast<uint64_t>((center.z - boxMin.z) * scale.z);
+            keys[t] = spreadBits(x) | (spreadBits(y) << 1) | (spreadBits(z) << 2);
+            order[t] = static_cast<uint32_t>(t);
+        }
+    }, 65536, threads);
+
+    if (!radixSort(keys, order, 3 * mortonBits, threads, control))
+        return false;
+
+    std::pmr::vector<common::Triangle> sorted(triangles.size(), memory);
+    parallelFor(triangles.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+            sorted[i] = triangles[order[i]];
+    }, 65536, threads);
+    std::copy(sorted.begin(), sorted.end(), triangles.begin());
+    if (permutation != nullptr)
+        std::copy(order.begin(), order.end(), permutation->begin());
+    return true;
+}
+
+namespace {
+
+// group the items by rows: rows[i] is the row of item i / itemSize, the items keep their order in rows
+void buildRows(const uint32_t *rows, size_t count, size_t nRows, size_t itemSize,
+               common::Adjacency &adjacency, std::pmr::memory_resource *memory)
+{
+    // the first pass counts the items of rows
+    adjacency.offsets.assign(nRows + 1, 0);
+    for (size_t i = 0; i < count; ++i)
+        ++adjacency.offsets[rows[i] + 1];
+    for (size_t i = 0; i < nRows; ++i)
+        adjacency.offsets[i + 1] += adjacency.offsets[i];
+
+    // the second pass places the items by the running positions of rows
+    adjacency.indices.resize(count);
+    std::pmr::vector<uint32_t> positions(adjacency.offsets.begin(), adjacency.offsets.end() - 1,
+                                         memoryOrDefault(memory));
+    for (size_t i = 0; i < count; ++i)
+        adjacency.indices[positions[rows[i]]++] = static_cast<uint32_t>(i / itemSize);
+}
+
+}
+
+void buildTriangleAdjacency(const uint32_t *rows, size_t count, size_t nRows,
+                            common::Adjacency &adjacency, std::pmr::memory_resource *memory)
+{
+    buildRows(rows, count, nRows, 3, adjacency, memory);
+}
+
+namespace {
+
+// the union-find of triangles with the path halving and the union by size
+class DisjointSets
+{
+    std::pmr::vector<uint32_t> m_parent;
+    std::pmr::vector<uint32_t> m_size;
+
+public:
+    DisjointSets(size_t count, std::pmr::memory_resource *memory)
+        : m_parent(count, memory)
+        , m_size(count, 1, memory)
+    {
+        for (size_t i = 0; i < count; ++i)
+            m_parent[i] = static_cast<uint32_t>(i);
+    }
+
+    uint32_t find(uint32_t i)
+    {
+        while (m_parent[i] != i)
+        {
+            m_parent[i] = m_parent[m_parent[i]];
+            i = m_parent[i];
+        }
+        return i;
+    }
+
+    // return false if they are in one set already
+    bool unite(uint32_t i, uint32_t j)
+    {
+        i = find(i);
+        j = find(j);
+        if (i == j)
+            return false;
+        if (m_size[i] < m_size[j])
+            std::swap(i, j);
+        m_parent[j] = i;
+        m_size[i] += m_size[j];
+        return true;
+    }
+};
+
+// the key of float which sorts ascending as unsigned
+inline uint32_t floatOrderKey(float value)
+{
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+}
+
+void buildMergeTree(const std::vector<common::PackedNormal> &normals,
+                    const common::Adjacency &edgeTriangles,
+                    common::MergeTree &tree, unsigned threads,
+                    std::pmr::memory_resource *memory, const uint64_t *degenerateMask)
+{
+    // input variables:
+    // normals - the normals of triangles
+    // edgeTriangles - the triangles of edges
+    // threads - the number of threads (0 - the number of cores)
+    // degenerateMask - bit i is set if triangle i has no normal (optional)
+
+    tree.clear();
+    memory = memoryOrDefault(memory);
+
+    // every pair of triangles sharing the edge is the candidate to merge
+    const size_t nEdges = edgeTriangles.size();
+    std::pmr::vector<size_t> pairOffsets(nEdges + 1, 0, memory);
+    for (size_t i = 0; i < nEdges; ++i)
+    {
+        size_t k = edgeTriangles[i].size();
+        pairOffsets[i + 1] = pairOffsets[i] + k * (k - 1) / 2;
+    }
+    const size_t nPairs = pairOffsets[nEdges];
+    if (nPairs == 0)
+        return;
+
+    std::pmr::vector<common::MergeTree::Merge> pairs(nPairs, memory);
+    std::pmr::vector<uint64_t> keys(nPairs, memory);
+    std::pmr::vector<uint32_t> order(nPairs, memory);
+    parallelFor(nEdges, [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            common::Adjacency::Row row = edgeTriangles[i];
+            size_t p = pairOffsets[i];
+            for (const uint32_t *t1 = row.begin(); t1 != row.end(); ++t1)
+            {
+                const common::Vector normal = normals[*t1].unpack();
+                for (const uint32_t *t2 = t1 + 1; t2 != row.end(); ++t2, ++p)
+                {
+                    float dot = static_cast<float>(normal * normals[*t2].unpack());
+                    pairs[p] = {dot, *t1, *t2};
+                    // the descending order of dot products
+                    keys[p] = ~floatOrderKey(dot);
+                    order[p] = static_cast<uint32_t>(p);
+                }
+            }
+        }
+    }, 65536, threads);
+
+    radixSort(keys, order, 32, threads);
+
+    // Kruskal: the pair merges two groups if they are not joined by the closer pairs yet
+    auto isDegenerate = [degenerateMask](uint32_t t)
+    {
+        return degenerateMask != nullptr && ((degenerateMask[t / 64] >> (t % 64)) & 1);
+    };
+    DisjointSets sets(normals.size(), memory);
+    for (uint32_t p : order)
+    {
+        const common::MergeTree::Merge &pair = pairs[p];
+        if (isDegenerate(pair.tri1) || isDegenerate(pair.tri2))
+            continue;
+        if (sets.unite(pair.tri1, pair.tri2))
+            tree.merges.push_back(pair);
+    }
+    tree.merges.shrink_to_fit();
+}
+
+void segmentByMergeTree(const common::MergeTree &tree, size_t nTriangles, double minDot,
+                        common::Adjacency &faces, std::vector<uint32_t> &triangleFaces,
+                        std::pmr::memory_resource *memory)
+{
+    // input variables:
+    // tree - the merge tree of triangles
+    // minDot - the minimum dot product of normals of neighbor triangles in one face
+
+    // the merges above the threshold are the prefix of tree
+    auto last = std::partition_point(tree.merges.begin(), tree.merges.end(),
+                                     [minDot](const common::MergeTree::Merge &merge)
+    {
+        return merge.dot >= minDot;
+    });
+
+    memory = memoryOrDefault(memory);
+    DisjointSets sets(nTriangles, memory);
+    for (auto it = tree.merges.begin(); it != last; ++it)
+        sets.unite(it->tri1, it->tri2);
+
+    // number the faces in the order of their first triangles
+    const uint32_t noFace = UINT32_MAX;
+    std::pmr::vector<uint32_t> rootFaces(nTriangles, noFace, memory);
+    triangleFaces.resize(nTriangles);
+    uint32_t nFaces = 0;
+    for (uint32_t i = 0; i < nTriangles; ++i)
+    {
+        uint32_t &face = rootFaces[sets.find(i)];
+        if (face == noFace)
+            face = nFaces++;
+        triangleFaces[i] = face;
+    }
+
+    buildRows(triangleFaces.data(), nTriangles, nFaces, 1, faces, memory);
+}
+
+namespace {
+
+// the symmetric 4x4 matrix of quadric error: the sum of squared distances to the planes
+struct Quadric
+{
+    double m[10] = {}; // aa ab ac ad bb bc bd cc cd dd
+
+    Quadric() = default;
+    // the plane a*x + b*y + c*z + d = 0 with the unit normal
+    Quadric(double a, double b, double c, double d)
+        : m{a*a, a*b, a*c, a*d, b*b, b*c, b*d, c*c, c*d, d*d}
+    {
+    }
+
+    Quadric &operator += (const Quadric &other)
+    {
+        for (int i = 0; i < 10; ++i)
+            m[i] += other.m[i];
+        return *this;
+    }
+
+    double error(const common::Vertex &p) const
+    {
+        return m[0]*p.x*p.x + 2*m[1]*p.x*p.y + 2*m[2]*p.x*p.z + 2*m[3]*p.x +
+               m[4]*p.y*p.y + 2*m[5]*p.y*p.z + 2*m[6]*p.y +
+               m[7]*p.z*p.z + 2*m[8]*p.z + m[9];
+    }
+
+    // the point of minimum error, false if the planes don't define it
+    bool minimum(common::Vertex &p) const
+    {
+        double det = m[0]*(m[4]*m[7] - m[5]*m[5]) -
+                     m[1]*(m[1]*m[7] - m[5]*m[2]) +
+                     m[2]*(m[1]*m[5] - m[4]*m[2]);
+        // the planes are (almost) parallel, the point can be anywhere along them
+        if (det < 1E-9)
+            return false;
+
+        // Cramer's rule for A*p = -b
+        p.x = -(m[3]*(m[4]*m[7] - m[5]*m[5]) -
+                m[1]*(m[6]*m[7] - m[5]*m[8]) +
+                m[2]*(m[6]*m[5] - m[4]*m[8])) / det;
+        p.y = -(m[0]*(m[6]*m[7] - m[8]*m[5]) -
+                m[3]*(m[1]*m[7] - m[5]*m[2]) +
+                m[2]*(m[1]*m[8] - m[6]*m[2])) / det;
+        p.z = -(m[0]*(m[4]*m[8] - m[5]*m[6]) -
+                m[1]*(m[1]*m[8] - m[6]*m[2]) +
+                m[3]*(m[1]*m[5] - m[4]*m[2])) / det;
+        return true;
+    }
+};
+
+// the edge collapse simplification by the quadric error: the edges are collapsed
+// in the passes with the growing error threshold, the triangles around the collapsed
+// edge are marked and wait for the next pass
+class MeshDecimator
+{
+    struct Vertex
+    {
+        common::Vertex p;
+        Quadric q;
+        uint32_t refStart = 0;  // the triangles of vertex in m_refs
+        uint32_t refCount = 0;
+        bool border = false;    // the vertex of open edge is never moved
+    };
+
+    struct Triangle
+    {
+        uint32_t v[3];
+        float error[4];         // the errors of edges v[i]-v[i+1] and their minimum
+        float normal[3];
+        bool deleted;
+        bool dirty;             // changed in the current pass
+    };
+
+    // the triangle and the position of vertex in it
+    struct Ref
+    {
+        uint32_t triangle;
+        uint32_t corner;
+    };
+
+    std::vector<Vertex> m_vertices;
+    std::vector<Triangle> m_triangles;
+    std::vector<Ref> m_refs;
+    size_t m_alive = 0;
+
+    void updateNormal(Triangle &tri) const;
+    double edgeError(uint32_t i0, uint32_t i1, common::Vertex &p) const;
+    void updateErrors(Triangle &tri) const;
+    void compact();
+    void buildRefs();
+    void findBorders();
+    bool flipped(const common::Vertex &p, uint32_t i0, uint32_t i1,
+                 std::vector<uint8_t> &deleted) const;
+    bool keepsManifold(uint32_t i0, uint32_t i1, const std::vector<uint8_t> &deleted,
+                       std::vector<uint32_t> &neighbors) const;
+    void updateTriangles(uint32_t i0, uint32_t iv, const std::vector<uint8_t> &deleted);
+
+public:
+    MeshDecimator(const std::vector<common::VertexF> &vertices,
+                  const std::vector<common::Triangle> &triangles,
+                  const common::Vertex &origin, double scale);
+    bool run(size_t targetTriangles, LoadControl *control);
+    void result(const common::Vertex &origin, double scale,
+                std::vector<common::VertexF> &vertices,
+                std::vector<common::Triangle> &triangles) const;
+};
+
+MeshDecimator::MeshDecimator(const std::vector<common::VertexF> &vertices,
+                             const std::vector<common::Triangle> &triangles,
+                             const common::Vertex &origin, double scale)
+{
+    m_vertices.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i)
+        m_vertices[i].p = (common::Vertex(vertices[i]) - origin) * scale;
+
+    m_triangles.reserve(triangles.size());
+    for (const common::Triangle &tri : triangles)
+    {
+        Triangle t;
+        std::copy(tri.coord, tri.coord + 3, t.v);
+        t.deleted = false;
+        t.dirty = false;
+        updateNormal(t);
+        // the degenerated triangles have no plane and are not drawn anyway
+        if (t.normal[0] == 0.0f && t.normal[1] == 0.0f && t.normal[2] == 0.0f)
+            continue;
+        m_triangles.push_back(t);
+
+        const common::Vertex &p = m_vertices[t.v[0]].p;
+        common::Vector nor(t.normal[0], t.normal[1], t.normal[2]);
+        normalize(nor);
+        Quadric q(nor.x, nor.y, nor.z, -(nor * common::Vector(p.x, p.y, p.z)));
+        for (uint32_t index : t.v)
+            m_vertices[index].q += q;
+    }
+    m_alive = m_triangles.size();
+
+    buildRefs();
+    findBorders();
+    for (Triangle &tri : m_triangles)
+        updateErrors(tri);
+}
+
+void MeshDecimator::updateNormal(Triangle &tri) const
+{
+    common::Vector nor;
+    calculateNormal(m_vertices[tri.v[0]].p, m_vertices[tri.v[1]].p, m_vertices[tri.v[2]].p, nor);
+    if (!normalize(nor))
+        nor = common::Vector(0.0, 0.0, 0.0);
+    tri.normal[0] = static_cast<float>(nor.x);
+    tri.normal[1] = static_cast<float>(nor.y);
+    tri.normal[2] = static_cast<float>(nor.z);
+}
+
+double MeshDecimator::edgeError(uint32_t i0, uint32_t i1, common::Vertex &p) const
+{
+    Quadric q = m_vertices[i0].q;
+    q += m_vertices[i1].q;
+    const common::Vertex &p0 = m_vertices[i0].p;
+    const common::Vertex &p1 = m_vertices[i1].p;
+    const common::Vertex mid = (p0 + p1) / 2;
+    // the almost flat surface puts the minimum far along it, such point is not taken
+    if (q.minimum(p) && common::Vector(mid, p).length() <= common::Vector(p0, p1).length())
+        return q.error(p);
+
+    // take the best of the ends and the middle
+    double error0 = q.error(p0);
+    double error1 = q.error(p1);
+    double errorMid = q.error(mid);
+    double error = std::min(std::min(error0, error1), errorMid);
+    p = error == error0 ? p0 : (error == error1 ? p1 : mid);
+    return error;
+}
+
+void MeshDecimator::updateErrors(Triangle &tri) const
+{
+    common::Vertex p;
+    for (int j = 0; j < 3; ++j)
+        tri.error[j] = static_cast<float>(edgeError(tri.v[j], tri.v[(j + 1) % 3], p));
+    tri.error[3] = std::min(std::min(tri.error[0], tri.error[1]), tri.error[2]);
+}
+
+void MeshDecimator::compact()
+{
+    m_triangles.erase(std::remove_if(m_triangles.begin(), m_triangles.end(),
+                                     [](const Triangle &tri) {return tri.deleted;}),
+                      m_triangles.end());
+    m_alive = m_triangles.size();
+}
+
+void MeshDecimator::buildRefs()
+{
+    for (Vertex &vertex : m_vertices)
+        vertex.refCount = 0;
+    for (const Triangle &tri : m_triangles)
+        for (uint32_t index : tri.v)
+            ++m_vertices[index].refCount;
+
+    uint32_t start = 0;
+    for (Vertex &vertex : m_vertices)
+    {
+        vertex.refStart = start;
+        start += vertex.refCount;
+        vertex.refCount = 0;
+    }
+
+    m_refs.resize(start);
+    for (uint32_t i = 0; i < m_triangles.size(); ++i)
+    {
+        for (uint32_t j = 0; j < 3; ++j)
+        {
+            Vertex &vertex = m_vertices[m_triangles[i].v[j]];
+            m_refs[vertex.refStart + vertex.refCount++] = {i, j};
+        }
+    }
+}
+
+void MeshDecimator::findBorders()
+{
+    // the open edge is used by one triangle, so its other vertex is met once
+    // among the triangles of vertex
+    std::vector<uint32_t> neighbors;
+    for (uint32_t i = 0; i < m_vertices.size(); ++i)
+    {
+        const Vertex &vertex = m_vertices[i];
+        neighbors.clear();
+        for (uint32_t k = 0; k < vertex.refCount; ++k)
+        {
+            const Ref &ref = m_refs[vertex.refStart + k];
+            const Triangle &tri = m_triangles[ref.triangle];
+            neighbors.push_back(tri.v[(ref.corner + 1) % 3]);
+            neighbors.push_back(tri.v[(ref.corner + 2) % 3]);
+        }
+        std::sort(neighbors.begin(), neighbors.end());
+        for (size_t k = 0; k < neighbors.size(); )
+        {
+            size_t next = k + 1;
+            while (next < neighbors.size() && neighbors[next] == neighbors[k])
+                ++next;
+            if (next - k == 1)
+            {
+                m_vertices[i].border = true;
+                m_vertices[neighbors[k]].border = true;
+            }
+            k = next;
+        }
+    }
+}
+
+bool MeshDecimator::flipped(const common::Vertex &p, uint32_t i0, uint32_t i1,
+                            std::vector<uint8_t> &deleted) const
+{
+    // input variables:
+    // p - the new position of vertex i0
+    // i1 - the other vertex of collapsed edge
+    // deleted - receives the flags of triangles of i0 which are removed by the collapse
+
+    const Vertex &vertex = m_vertices[i0];
+    deleted.assign(vertex.refCount, 0);
+    for (uint32_t k = 0; k < vertex.refCount; ++k)
+    {
+        const Ref &ref = m_refs[vertex.refStart + k];
+        const Triangle &tri = m_triangles[ref.triangle];
+        if (tri.deleted)
+            continue;
+
+        uint32_t id1 = tri.v[(ref.corner + 1) % 3];
+        uint32_t id2 = tri.v[(ref.corner + 2) % 3];
+        if (id1 == i1 || id2 == i1)
+        {
+            deleted[k] = 1;
+            continue;
+        }
+
+        common::Vector d1(p, m_vertices[id1].p);
+        common::Vector d2(p, m_vertices[id2].p);
+        common::Vector nor = d1 % d2;
+        if (!normalize(nor))
+            return true;
+        // the triangle turns over
+        if (nor.x * tri.normal[0] + nor.y * tri.normal[1] + nor.z * tri.normal[2] < 0.2)
+            return true;
+    }
+    return false;
+}
+
+bool MeshDecimator::keepsManifold(uint32_t i0, uint32_t i1, const std::vector<uint8_t> &deleted,
+                                  std::vector<uint32_t> &neighbors) const
+{
+    // input variables:
+    // deleted - the flags of triangles of i0 which contain the edge (see flipped)
+
+    // the vertices connected to both ends are the opposite vertices of the edge's
+    // triangles only, otherwise the collapse folds the surface
+    auto collect = [this, &neighbors](uint32_t index)
+    {
+        size_t start = neighbors.size();
+        const Vertex &vertex = m_vertices[index];
+        for (uint32_t k = 0; k < vertex.refCount; ++k)
+        {
+            const Ref &ref = m_refs[vertex.refStart + k];
+            const Triangle &tri = m_triangles[ref.triangle];
+            if (tri.deleted)
+                continue;
+            neighbors.push_back(tri.v[(ref.corner + 1) % 3]);
+            neighbors.push_back(tri.v[(ref.corner + 2) % 3]);
+        }
+        std::sort(neighbors.begin() + start, neighbors.end());
+        neighbors.erase(std::unique(neighbors.begin() + start, neighbors.end()), neighbors.end());
+        return neighbors.size() - start;
+    };
+
+    neighbors.clear();
+    size_t count0 = collect(i0);
+    collect(i1);
+    size_t common = 0;
+    auto first0 = neighbors.begin();
+    auto first1 = neighbors.begin() + count0;
+    for (auto it = first0, jt = first1; it != first1 && jt != neighbors.end(); )
+    {
+        if (*it < *jt)
+            ++it;
+        else if (*jt < *it)
+            ++jt;
+        else
+        {
+            ++common;
+            ++it;
+            ++jt;
+        }
+    }
+    // the ends themselves are not counted (they are the neighbors of each other)
+    size_t shared = static_cast<size_t>(std::count(deleted.begin(), deleted.end(), 1));
+    return common == shared;
+}
+
+void MeshDecimator::updateTriangles(uint32_t i0, uint32_t iv, const std::vector<uint8_t> &deleted)
+{
+    const Vertex &vertex = m_vertices[iv];
+    for (uint32_t k = 0; k < vertex.refCount; ++k)
+    {
+        // the refs are appended below, so the ref is copied
+        const Ref ref = m_refs[vertex.refStart + k];
+        Triangle &tri = m_triangles[ref.triangle];
+        if (tri.deleted)
+            continue;
+        if (deleted[k])
+        {
+            tri.deleted = true;
+            --m_alive;
+            continue;
+        }
+
+        tri.v[ref.corner] = i0;
+        tri.dirty = true;
+        updateNormal(tri);
+        updateErrors(tri);
+        m_refs.push_back(ref);
+    }
+}
+
+bool MeshDecimator::run(size_t targetTriangles, LoadControl *control)
+{
+    std::vector<uint8_t> deleted0;
+    std::vector<uint8_t> deleted1;
+    std::vector<uint32_t> neighbors;
+    for (int pass = 0; m_alive > targetTriangles; ++pass)
+    {
+        if (control != nullptr && control->isCancelled())
+            return false;
+
+        // the threshold of error grows fast, the cheapest collapses are done first;
+        // the mesh which can't be simplified more by small errors stays as it is
+        const double threshold = 1E-9 * pow(pass + 3, 7.0);
+        if (threshold > 1.0)
+            break;
+
+        // drop the removed triangles and the refs appended by the collapses
+        if (pass > 0 && pass % 5 == 0)
+        {
+            compact();
+            buildRefs();
+        }
+
+        for (Triangle &tri : m_triangles)
+            tri.dirty = false;
+
+        for (Triangle &tri : m_triangles)
+        {
+            if (tri.deleted || tri.dirty || tri.error[3] > threshold)
+                continue;
+
+            for (int j = 0; j < 3; ++j)
+            {
+                if (tri.error[j] > threshold)
+                    continue;
+
+                uint32_t i0 = tri.v[j];
+                uint32_t i1 = tri.v[(j + 1) % 3];
+                if (m_vertices[i0].border || m_vertices[i1].border)
+                    continue;
+
+                common::Vertex p;
+                edgeError(i0, i1, p);
+                if (flipped(p, i0, i1, deleted0) || flipped(p, i1, i0, deleted1) ||
+                    !keepsManifold(i0, i1, deleted0, neighbors))
+                    continue;
+
+                // move the vertex i0 and join the triangles of i1 to it
+                m_vertices[i0].p = p;
+                m_vertices[i0].q += m_vertices[i1].q;
+                size_t refStart = m_refs.size();
+                updateTriangles(i0, i0, deleted0);
+                updateTriangles(i0, i1, deleted1);
+                if (m_refs.size() > UINT32_MAX)
+                    return false;
+                m_vertices[i0].refStart = static_cast<uint32_t>(refStart);
+                m_vertices[i0].refCount = static_cast<uint32_t>(m_refs.size() - refStart);
+                break;
+            }
+
+            if (m_alive <= targetTriangles)
+                break;
+        }
+    }
+    return true;
+}
+
+void MeshDecimator::result(const common::Vertex &origin, double scale,
+                           std::vector<common::VertexF> &vertices,
+                           std::vector<common::Triangle> &triangles) const
+{
+    // only the vertices of remaining triangles are taken
+    const uint32_t noIndex = UINT32_MAX;
+    std::vector<uint32_t> remap(m_vertices.size(), noIndex);
+    vertices.clear();
+    triangles.clear();
+    triangles.reserve(m_alive);
+    for (const Triangle &tri : m_triangles)
+    {
+        if (tri.deleted)
+            continue;
+
+        common::Triangle res;
+        for (int j = 0; j < 3; ++j)
+        {
+            uint32_t &index = remap[tri.v[j]];
+            if (index == noIndex)
+            {
+                index = static_cast<uint32_t>(vertices.size());
+                vertices.push_back(common::VertexF(m_vertices[tri.v[j]].p / scale + origin));
+            }
+            res.coord[j] = index;
+        }
+        triangles.push_back(res);
+    }
+}
+
+}
+
+bool decimateMesh(const std::vector<common::VertexF> &vertices,
+                  const std::vector<common::Triangle> &triangles, size_t targetTriangles,
+                  std::vector<common::VertexF> &levelVertices,
+                  std::vector<common::Triangle> &levelTriangles, LoadControl *control)
+{
+    // input variables:
+    // vertices, triangles - the mesh to simplify
+    // targetTriangles - the number of triangles to stop at (it can stay more)
+    // control - the cancellation (optional)
+
+    levelVertices.clear();
+    levelTriangles.clear();
+    if (vertices.empty() || triangles.empty())
+        return false;
+
+    // the errors are measured in the unit box, so the thresholds don't depend on the size
+    common::Vertex boxMin( DBL_MAX, DBL_MAX, DBL_MAX);
+    common::Vertex boxMax(-DBL_MAX,-DBL_MAX,-DBL_MAX);
+    for (const common::VertexF &v : vertices)
+    {
+        boxMin = {std::min<double>(boxMin.x, v.x), std::min<double>(boxMin.y, v.y), std::min<double>(boxMin.z, v.z)};
+        boxMax = {std::max<double>(boxMax.x, v.x), std::max<double>(boxMax.y, v.y), std::max<double>(boxMax.z, v.z)};
+    }
+    double size = std::max(std::max(boxMax.x - boxMin.x, boxMax.y - boxMin.y), boxMax.z - boxMin.z);
+    double scale = size > DBL_EPSILON ? 1.0 / size : 1.0;
+
+    MeshDecimator decimator(vertices, triangles, boxMin, scale);
+    if (!decimator.run(targetTriangles, control))
+        return false;
+    decimator.result(boxMin, scale, levelVertices, levelTriangles);
+    return true;
+}
+
+bool buildMeshLevels(const std::vector<common::VertexF> &vertices,
+                     const std::vector<common::Triangle> &triangles,
+                     std::vector<common::MeshLevel> &levels, int count, int factor,
+                     LoadControl *control)
+{
+    levels.clear();
+    levels.reserve(count);
+    // every level is simplified from the previous one, which is much cheaper
+    const std::vector<common::VertexF> *sourceVertices = &vertices;
+    const std::vector<common::Triangle> *sourceTriangles = &triangles;
+    size_t target = triangles.size();
+    for (int i = 0; i < count; ++i)
+    {
+        target /= factor;
+        common::MeshLevel level;
+        if (!decimateMesh(*sourceVertices, *sourceTriangles, target,
+                          level.vertices, level.triangles, control))
+            return false;
+        // the mesh can't be simplified more (all its edges are open for example)
+        if (level.triangles.empty() || level.triangles.size() >= sourceTriangles->size())
+            break;
+
+        levels.push_back(std::move(level));
+        sourceVertices = &levels.back().vertices;
+        sourceTriangles = &levels.back().triangles;
+    }
+    return true;
+}
+
+namespace {
+
+// the triangles of chunk are summed in the same order by any number of threads
+const size_t overhangChunk = 65536;
+
+// the triangles [begin, end) (begin is a multiple of 64), the area of triangle i is
+// added to sums[i % 4], the SSE2 and the scalar code give the same bits and sums
+void detectOverhangWords(const float *normalZ, const float *topZ, const float *area,
+                         size_t begin, size_t end, float maxNormalZ, float groundLevel,
+                         uint64_t *mask, double sums[4])
+{
+#ifdef OVERHANG_SSE2
+    const __m128 maxNormal = _mm_set1_ps(maxNormalZ);
+    const __m128 ground = _mm_set1_ps(groundLevel);
+    __m128d sum01 = _mm_setzero_pd();
+    __m128d sum23 = _mm_setzero_pd();
+#endif
+    for (size_t word = begin / 64; 64 * word < end; ++word)
+    {
+        uint64_t bits = 0;
+        size_t i = 64 * word;
+        const size_t last = std::min(end, i + 64);
+#ifdef OVERHANG_SSE2
+        for (; i + 4 <= last; i += 4)
+        {
+            const __m128 supported = _mm_and_ps(_mm_cmplt_ps(_mm_loadu_ps(normalZ + i), maxNormal),
+                                                _mm_cmpge_ps(_mm_loadu_ps(topZ + i), ground));
+            bits |= static_cast<uint64_t>(_mm_movemask_ps(supported)) << (i % 64);
+            const __m128 supportedArea = _mm_and_ps(supported, _mm_loadu_ps(area + i));
+            sum01 = _mm_add_pd(sum01, _mm_cvtps_pd(supportedArea));
+            sum23 = _mm_add_pd(sum23, _mm_cvtps_pd(_mm_movehl_ps(supportedArea, supportedArea)));
+        }
+#endif
+        for (; i < last; ++i)
+        {
+            if (normalZ[i] < maxNormalZ && topZ[i] >= groundLevel)
+            {
+                bits |= uint64_t(1) << (i % 64);
+                sums[i % 4] += area[i];
+            }
+        }
+        mask[word] = bits;
+    }
+#ifdef OVERHANG_SSE2
+    double lanes[4];
+    _mm_storeu_pd(lanes, sum01);
+    _mm_storeu_pd(lanes + 2, sum23);
+    for (int k = 0; k < 4; ++k)
+        sums[k] += lanes[k];
+#endif
+}
+
+}
+
+double detectOverhangs(const float *normalZ, const float *topZ, const float *area, size_t count,
+                       float maxNormalZ, float groundLevel, uint64_t *mask, unsigned threads)
+{
+    // the chunks are the multiples of 64, so every word of mask is written by one thread
+    const size_t nChunks = (count + overhangChunk - 1) / overhangChunk;
+    std::vector<double> chunkArea(nChunks, 0.0);
+    parallelFor(nChunks, [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; ++c)
+        {
+            double sums[4] = {0.0, 0.0, 0.0, 0.0};
+            detectOverhangWords(normalZ, topZ, area, c * overhangChunk,
+                                std::min(count, (c + 1) * overhangChunk),
+                                maxNormalZ, groundLevel, mask, sums);
+            chunkArea[c] = (sums[0] + sums[1]) + (sums[2] + sums[3]);
+        }
+    }, 1, threads);
+
+    // the chunks are added in their order
+    double total = 0.0;
+    for (double value : chunkArea)
+        total += value;
+    return total;
+}
+
+size_t residentMemory()
+{
+#if defined(Q_OS_LINUX)
+    // the second number is the resident pages
+    FILE *file = fopen("/proc/self/statm", "r");
+    if (file == nullptr)
+        return 0;
+    unsigned long pages = 0;
+    unsigned long resident = 0;
+    int n = fscanf(file, "%lu %lu", &pages, &resident);
+    fclose(file);
+    return n == 2 ? resident * static_cast<size_t>(sysconf(_SC_PAGESIZE)) : 0;
+#elif defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.WorkingSetSize;
+#else
+    return 0;
+#endif
+}
+
+size_t peakResidentMemory()
+{
+#if defined(Q_OS_LINUX)
+    // VmHWM is reset by clear_refs, unlike the maximum of getrusage
+    FILE *file = fopen("/proc/self/status", "r");
+    if (file == nullptr)
+        return 0;
+    char line[256];
+    size_t peak = 0;
+    while (fgets(line, sizeof(line), file) != nullptr)
+    {
+        unsigned long kb;
+        if (sscanf(line, "VmHWM: %lu kB", &kb) == 1)
+        {
+            peak = kb * 1024;
+            break;
+        }
+    }
+    fclose(file);
+    return peak;
+#elif defined(Q_OS_UNIX)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+#ifdef Q_OS_MACOS
+    return static_cast<size_t>(usage.ru_maxrss);
+#else
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+#endif
+#elif defined(Q_OS_WIN)
+    PROCESS_MEMORY_COUNTERS counters;
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+        return 0;
+    return counters.PeakWorkingSetSize;
+#else
+    return 0;
+#endif
+}
+
+namespace {
+
+std::mutex stageMemoryMutex;
+std::vector<StageMemory> stageMemoryLogData;
+// the stages of all threads, guarded by stageMemoryMutex like the log,
+// the process peak is reset only when no stage is active
+int activeStages = 0;
+
+}
+
+StageMemoryScope::StageMemoryScope(const char *stage)
+{
+    std::lock_guard<std::mutex> lock(stageMemoryMutex);
+    m_stage.stage = stage;
+    m_outer = (activeStages++ == 0);
+#ifdef Q_OS_LINUX
+    // start the peak from the current memory (if the kernel allows)
+    if (m_outer)
+    {
+        FILE *file = fopen("/proc/self/clear_refs", "w");
+        if (file != nullptr)
+        {
+            fputs("5", file);
+            fclose(file);
+        }
+    }
+#endif
+    m_stage.before = residentMemory();
+}
+
+StageMemoryScope::~StageMemoryScope()
+{
+    std::lock_guard<std::mutex> lock(stageMemoryMutex);
+    --activeStages;
+    m_stage.after = residentMemory();
+    m_stage.peak = std::max(peakResidentMemory(), m_stage.after);
+
+    for (StageMemory &stage : stageMemoryLogData)
+    {
+        if (stage.stage == m_stage.stage)
+        {
+            stage = m_stage;
+            return;
+        }
+    }
+    stageMemoryLogData.push_back(m_stage);
+}
+
+std::vector<StageMemory> stageMemoryLog()
+{
+    std::lock_guard<std::mutex> lock(stageMemoryMutex);
+    return stageMemoryLogData;
+}
+
 bool normalize(common::Vector &nor)
 {
     double magn = sqrt(nor.x*nor.x + nor.y*nor.y + nor.z*nor.z);
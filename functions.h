@@ -2,13 +2,175 @@
 
 #include "common.h"
 #include <QString>
+#include <QFile>
 #include <vector>
+#include <functional>
+#include <atomic>
+#include <memory_resource>
 
-int getStlFileFormat(const QString &path);
-bool openStlBin(char *filename, std::vector<common::Vertex> &vertices,
-                std::vector<common::Triangle> &faces);
-bool openStlAsc(char *filename, std::vector<common::Vertex> &vertices,
-                std::vector<common::Triangle> &faces);
+// read-only mapping of the whole file
+class MappedFile
+{
+public:
+    MappedFile() = default;
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator = (const MappedFile &) = delete;
+    ~MappedFile();
+
+    bool open(const QString &path);
+    void close();
+    // hint the system that the mapping is going to be read once from start to end
+    void adviseSequential() const;
+
+    inline const uchar *data() const {return m_data;}
+    inline uint64_t size() const {return m_size;}
+
+private:
+    QFile m_file;
+    uchar *m_data = nullptr;
+    uint64_t m_size = 0;
+};
+
+// the tolerance to merge the close vertices of loaded facets
+struct WeldTolerance
+{
+    double value = 1E-5;    // the maximum distance by each axis
+    bool relative = false;  // the value is a fraction of bounding box diagonal
+};
+
+// the progress report and the cancellation of loading which runs in a worker thread
+struct LoadControl
+{
+    // the stages of loading
+    enum Stage {Parse, Weld, Read};
+
+    std::atomic<bool> cancelled {false};
+    // receives the percent of loading, called by the loading thread
+    std::function<void(int)> progress;
+    // receives the facets' vertices (3 per facet) before welding, called by the loading thread
+    std::function<void(const std::vector<common::Vertex> &)> soupReady;
+
+    inline bool isCancelled() const {return cancelled.load(std::memory_order_relaxed);}
+    void report(Stage stage, uint64_t done, uint64_t total) const;
+    void soupLoaded(const std::vector<common::Vertex> &soup) const;
+};
+
+// load the model file, return false with the error message (empty if cancelled) on failure,
+// the vertices of STL facets are welded by the tolerance
+bool loadModel(const QString &path, std::vector<common::Vertex> &vertices,
+               std::vector<common::Triangle> &faces, QString &error,
+               const WeldTolerance &tolerance = WeldTolerance(),
+               LoadControl *control = nullptr);
+
+// the file is mapped once, the format detection and the loaders read the same mapping
+int getStlFileFormat(const MappedFile &file);
+bool openStlBin(const MappedFile &file, std::vector<common::Vertex> &vertices,
+                std::vector<common::Triangle> &faces,
+                const WeldTolerance &tolerance = WeldTolerance(),
+                unsigned threads = 0, LoadControl *control = nullptr);
+bool openStlAsc(const MappedFile &file, std::vector<common::Vertex> &vertices,
+                std::vector<common::Triangle> &faces,
+                const WeldTolerance &tolerance = WeldTolerance(),
+                unsigned threads = 0, LoadControl *control = nullptr);
+// the indexed formats, the vertices are used as they are (without welding),
+// the polygons are triangulated by fan
+bool openObj(const MappedFile &file, std::vector<common::Vertex> &vertices,
+             std::vector<common::Triangle> &faces, LoadControl *control = nullptr);
+bool openPly(const MappedFile &file, std::vector<common::Vertex> &vertices,
+             std::vector<common::Triangle> &faces, LoadControl *control = nullptr);
+// merge the vertices of triangle soup (3 vertices per triangle) into indexed mesh
+bool weldVertices(const std::vector<common::Vertex> &soup, const WeldTolerance &tolerance,
+                  std::vector<common::Vertex> &vertices, std::vector<common::Triangle> &faces,
+                  unsigned threads = 0, LoadControl *control = nullptr);
+
+// the topology functions take the memory of their temporary arrays (the heap if nullptr)
+
+// extract the edges of triangles and the triangle-edge connector (3 edges per triangle),
+// return false if cancelled
+bool buildEdges(const std::vector<common::Triangle> &triangles,
+                std::vector<common::Edge> &edges, std::vector<uint32_t> &triangleEdges,
+                unsigned threads = 0, std::pmr::memory_resource *memory = nullptr,
+                LoadControl *control = nullptr);
+// order the triangles along the Morton curve of their centers, so every run of
+// neighbor triangles in the array covers a small part of the model, return false if cancelled;
+// permutation[i] is the index of triangle i before the sort (the source facet)
+bool sortTrianglesSpatially(const std::vector<common::Vertex> &vertices,
+                            std::vector<common::Triangle> &triangles,
+                            unsigned threads = 0, std::pmr::memory_resource *memory = nullptr,
+                            LoadControl *control = nullptr,
+                            std::vector<uint32_t> *permutation = nullptr);
+// group the triangles by rows: rows[k] is the row of triangle k/3 (the edges of
+// triangleEdges or the vertices of triangles), the triangles keep their order in rows
+void buildTriangleAdjacency(const uint32_t *rows, size_t count, size_t nRows,
+                            common::Adjacency &adjacency,
+                            std::pmr::memory_resource *memory = nullptr);
+
+// build the merge tree of triangles sharing the edges (Kruskal's order by the dot product of normals),
+// the triangles with the bits set in degenerateMask have no normals and are not merged
+void buildMergeTree(const std::vector<common::PackedNormal> &normals,
+                    const common::Adjacency &edgeTriangles,
+                    common::MergeTree &tree, unsigned threads = 0,
+                    std::pmr::memory_resource *memory = nullptr,
+                    const uint64_t *degenerateMask = nullptr);
+// split the triangles into faces joined by the merges with dot >= minDot,
+// the faces are ordered by their first triangles
+void segmentByMergeTree(const common::MergeTree &tree, size_t nTriangles, double minDot,
+                        common::Adjacency &faces, std::vector<uint32_t> &triangleFaces,
+                        std::pmr::memory_resource *memory = nullptr);
+// simplify the mesh by the quadric error edge collapse to about targetTriangles
+// (the open edges are kept), return false if cancelled
+bool decimateMesh(const std::vector<common::VertexF> &vertices,
+                  const std::vector<common::Triangle> &triangles, size_t targetTriangles,
+                  std::vector<common::VertexF> &levelVertices,
+                  std::vector<common::Triangle> &levelTriangles, LoadControl *control = nullptr);
+// build the levels of detail, every level has about 1/factor of triangles of the previous one
+bool buildMeshLevels(const std::vector<common::VertexF> &vertices,
+                     const std::vector<common::Triangle> &triangles,
+                     std::vector<common::MeshLevel> &levels, int count, int factor,
+                     LoadControl *control = nullptr);
+// find the triangles which need support by the structure of arrays: the z of normal is
+// less than maxNormalZ and the highest vertex (topZ) is not lower than groundLevel,
+// bit i of mask ((count + 63) / 64 words) is set for triangle i, return the sum of
+// their area (the same for any number of threads)
+double detectOverhangs(const float *normalZ, const float *topZ, const float *area, size_t count,
+                       float maxNormalZ, float groundLevel, uint64_t *mask, unsigned threads = 0);
+// the number of threads to use (0 - all cores)
+unsigned workerThreads(unsigned threads = 0);
+// call body(begin, end) for the parts of range [0, count) in parallel threads
+void parallelFor(size_t count, const std::function<void(size_t, size_t)> &body,
+                 size_t minChunk = 1, unsigned threads = 0);
+
+// the resident memory of process in bytes (0 if unknown)
+size_t residentMemory();
+// the peak resident memory in bytes since the last reset by StageMemoryScope (or the start)
+size_t peakResidentMemory();
+
+// the memory of pipeline stage in bytes
+struct StageMemory
+{
+    QString stage;
+    size_t before = 0; // the resident memory at the start
+    size_t after = 0;  // the resident memory at the end
+    size_t peak = 0;   // the peak resident memory during the stage
+};
+
+// measure the memory of stage while the object lives, the log keeps the last
+// measurement of every stage (the nested stages report the peak of outer one);
+// the memory is of the whole process, so the peak of stage includes the stages
+// running in other threads at the same time (the loading and the scene analysis)
+class StageMemoryScope
+{
+    StageMemory m_stage;
+    bool m_outer;
+
+public:
+    explicit StageMemoryScope(const char *stage);
+    ~StageMemoryScope();
+
+    StageMemoryScope(const StageMemoryScope&) = delete;
+    StageMemoryScope &operator=(const StageMemoryScope&) = delete;
+};
+std::vector<StageMemory> stageMemoryLog();
 
 bool normalize(common::Vector &nor);
 void calculateNormal(const common::Vertex &v1,
@@ -0,0 +1,87 @@
+#include "gpubuffer.h"
+#include <algorithm>
+
+GpuBuffer::GpuBuffer(GLenum target, GLenum usage) : m_target(target), m_usage(usage)
+{
+}
+
+void GpuBuffer::invalidate()
+{
+    m_reallocate = true;
+}
+
+void GpuBuffer::invalidate(size_t begin, size_t end)
+{
+    if (begin >= end)
+        return;
+
+    // the ranges are joined into one, the bytes between them are uploaded too
+    if (m_dirtyBegin >= m_dirtyEnd)
+    {
+        m_dirtyBegin = begin;
+        m_dirtyEnd = end;
+    }
+    else
+    {
+        m_dirtyBegin = std::min(m_dirtyBegin, begin);
+        m_dirtyEnd = std::max(m_dirtyEnd, end);
+    }
+}
+
+void GpuBuffer::upload(QOpenGLFunctions *gl, const void *data, size_t bytes)
+{
+    // input variables:
+    // gl - the functions of current context
+    // data, bytes - the array kept in memory
+
+    if (bytes == 0)
+    {
+        destroy(gl);
+        return;
+    }
+
+    bool reallocate = m_reallocate || m_id == 0 || bytes != m_size;
+    if (!reallocate && m_dirtyBegin >= m_dirtyEnd)
+        return;
+
+    if (m_id == 0)
+        gl->glGenBuffers(1, &m_id);
+    gl->glBindBuffer(m_target, m_id);
+    if (reallocate)
+    {
+        gl->glBufferData(m_target, static_cast<GLsizeiptr>(bytes), data, m_usage);
+        m_size = bytes;
+    }
+    else
+    {
+        size_t end = std::min(m_dirtyEnd, bytes);
+        if (m_dirtyBegin < end)
+            gl->glBufferSubData(m_target, static_cast<GLintptr>(m_dirtyBegin),
+                                static_cast<GLsizeiptr>(end - m_dirtyBegin),
+                                static_cast<const char*>(data) + m_dirtyBegin);
+    }
+    gl->glBindBuffer(m_target, 0);
+
+    m_reallocate = false;
+    m_dirtyBegin = m_dirtyEnd = 0;
+}
+
+void GpuBuffer::bind(QOpenGLFunctions *gl) const
+{
+    gl->glBindBuffer(m_target, m_id);
+}
+
+void GpuBuffer::release(QOpenGLFunctions *gl) const
+{
+    gl->glBindBuffer(m_target, 0);
+}
+
+void GpuBuffer::destroy(QOpenGLFunctions *gl)
+{
+    if (m_id != 0)
+        gl->glDeleteBuffers(1, &m_id);
+    m_id = 0;
+    m_size = 0;
+    m_reallocate = true;
+    m_dirtyBegin = m_dirtyEnd = 0;
+}
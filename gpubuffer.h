@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QOpenGLFunctions>
+#include <vector>
+#include <stddef.h>
+
+// the buffer object on GPU filled from the array kept in memory: the changed ranges
+// of array are marked and only they are uploaded before drawing, so the frame itself
+// transfers nothing
+class GpuBuffer
+{
+    GLenum m_target;            // GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER
+    GLenum m_usage;
+    GLuint m_id = 0;
+    size_t m_size = 0;          // the bytes allocated on GPU
+    size_t m_dirtyBegin = 0;    // the changed bytes not uploaded yet
+    size_t m_dirtyEnd = 0;
+    bool m_reallocate = true;   // the whole array is to be uploaded
+
+public:
+    GpuBuffer(GLenum target, GLenum usage = GL_STATIC_DRAW);
+
+    GpuBuffer(const GpuBuffer&) = delete;
+    GpuBuffer &operator=(const GpuBuffer&) = delete;
+
+    // the whole array is changed
+    void invalidate();
+    // the bytes begin .. end - 1 of array are changed
+    void invalidate(size_t begin, size_t end);
+    // the items first .. first + count - 1 of array are changed
+    template <class T>
+    inline void invalidate(const std::vector<T> &, size_t first, size_t count)
+    {
+        invalidate(first * sizeof(T), (first + count) * sizeof(T));
+    }
+
+    // upload the changed part of array (the context must be current),
+    // the array of other size is uploaded again, the empty one frees the buffer
+    void upload(QOpenGLFunctions *gl, const void *data, size_t bytes);
+    template <class T>
+    inline void upload(QOpenGLFunctions *gl, const std::vector<T> &array)
+    {
+        upload(gl, array.data(), array.size() * sizeof(T));
+    }
+
+    // while the buffer is bound the pointers of arrays are the offsets in it
+    void bind(QOpenGLFunctions *gl) const;
+    void release(QOpenGLFunctions *gl) const;
+    // free the buffer on GPU, the next upload creates it again
+    void destroy(QOpenGLFunctions *gl);
+
+    inline bool isEmpty() const {return m_size == 0;}
+    inline size_t size() const {return m_size;}
+};
@@ -1,14 +1,149 @@
 #include "mainWindow.h"
 #include "scene3d.h"
+#include "thumbnailbatch.h"
 #include <stdlib.h>
+#include <string.h>
 #include <QtWidgets/QApplication>
+#include <QCommandLineParser>
+#include <QDebug>
+
+namespace {
+
+// the elements of scene by their names separated by commas
+bool parseElements(const QString &text, int &showMask)
+{
+    showMask = 0;
+    for (const QString &name : text.split(',', QString::SkipEmptyParts))
+    {
+        QString element = name.trimmed().toLower();
+        if (element == "axis")
+            showMask |= shAxis;
+        else if (element == "wireframe")
+            showMask |= shWireframe;
+        else if (element == "triangles")
+            showMask |= shTriangles;
+        else if (element == "normals")
+            showMask |= shNormals;
+        else if (element == "ground")
+            showMask |= shGround;
+        else
+            return false;
+    }
+    return true;
+}
+
+// the rotation by three angles separated by commas
+bool parseRotation(const QString &text, common::Vector &rotate)
+{
+    QStringList angles = text.split(',');
+    if (angles.size() != 3)
+        return false;
+    bool ok[3];
+    rotate = {angles[0].toDouble(&ok[0]), angles[1].toDouble(&ok[1]), angles[2].toDouble(&ok[2])};
+    return ok[0] && ok[1] && ok[2];
+}
+
+// the option is in the raw arguments (with the value after '=' or not)
+bool hasOption(int argc, char **argv, const char *name)
+{
+    const size_t length = strlen(name);
+    for (int i = 1; i < argc; ++i)
+        if (strncmp(argv[i], name, length) == 0 && (argv[i][length] == '\0' || argv[i][length] == '='))
+            return true;
+    return false;
+}
+
+}
 
 // Entry point of application
 int main(int argc, char** argv)
 {
     QCoreApplication::addLibraryPath("./");
+
+    // the batch options are found before the application is created to set up the headless
+    // drawing, the options are parsed after the application removes the options of Qt
+    const bool batch = hasOption(argc, argv, "--thumbnails");
+    const bool help = hasOption(argc, argv, "--help") || hasOption(argc, argv, "-h");
+    bool noDisplay = false;
+    if (batch)
+    {
+#if defined(Q_OS_UNIX) && !defined(Q_OS_MACOS)
+        // no window is shown, so the display is not needed, but OpenGL of the offscreen
+        // platform of Qt 5 needs it too, so the models are drawn on CPU then (unless
+        // the platform is chosen by the user)
+        noDisplay = qEnvironmentVariableIsEmpty("DISPLAY") && qEnvironmentVariableIsEmpty("WAYLAND_DISPLAY") &&
+                    qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM");
+        if (noDisplay)
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+#endif
+        if (hasOption(argc, argv, "--software-gl"))
+            QCoreApplication::setAttribute(Qt::AA_UseSoftwareOpenGL);
+    }
+
     QApplication app(argc, argv);
 
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Mesh Viewer");
+    parser.addHelpOption();
+    parser.addPositionalArgument("models", "The models or the folders of models to render the thumbnails of.",
+                                 "[models...]");
+    QCommandLineOption thumbnailsOption("thumbnails", "Render the thumbnails of models into <folder> without window. "
+                                        "Without a display (Linux) they are drawn on CPU.", "folder");
+    QCommandLineOption sizeOption("size", "The width and the height of thumbnails in pixels.", "pixels", "256");
+    QCommandLineOption viewOption("view", "The view rotation around X, Y and Z axes in degrees.", "x,y,z", "-90,0,0");
+    QCommandLineOption elementsOption("elements", "The drawn elements: axis, wireframe, triangles, normals, ground.",
+                                      "list", "wireframe,triangles");
+    QCommandLineOption threadsOption("threads", "The number of loading threads (0 - the number of cores).",
+                                     "number", "0");
+    QCommandLineOption softwareOption("software-gl", "Use the software implementation of OpenGL (Windows only).");
+    QCommandLineOption cpuOption("cpu", "Draw the shaded triangles by the CPU rasterizer without OpenGL.");
+    QCommandLineOption weldOption("weld", "The tolerance to merge the close vertices of STL models, in mm "
+                                  "or as a fraction of the bounding box diagonal with --weld-relative.",
+                                  "tolerance", "1e-5");
+    QCommandLineOption weldRelativeOption("weld-relative", "The weld tolerance is relative to the model size.");
+    parser.addOptions({thumbnailsOption, sizeOption, viewOption, elementsOption, threadsOption, softwareOption,
+                       cpuOption, weldOption, weldRelativeOption});
+
+    // the normal start takes no options
+    if (batch || help)
+    {
+        QStringList arguments;
+        for (int i = 0; i < argc; ++i)
+            arguments << QString::fromLocal8Bit(argv[i]);
+        if (!parser.parse(arguments))
+        {
+            qWarning().noquote() << parser.errorText();
+            return 1;
+        }
+        if (parser.isSet("help"))
+            parser.showHelp();
+    }
+
+    if (batch)
+    {
+        ThumbnailOptions options;
+        options.inputs = parser.positionalArguments();
+        options.outputDir = parser.value(thumbnailsOption);
+        bool sizeOk = false;
+        bool threadsOk = false;
+        bool weldOk = false;
+        options.size = parser.value(sizeOption).toInt(&sizeOk);
+        options.threads = parser.value(threadsOption).toUInt(&threadsOk);
+        options.tolerance.value = parser.value(weldOption).toDouble(&weldOk);
+        options.tolerance.relative = parser.isSet(weldRelativeOption);
+        options.cpu = parser.isSet(cpuOption) || noDisplay;
+        if (noDisplay && !parser.isSet(cpuOption))
+            qInfo() << "No display for OpenGL, the thumbnails are drawn on CPU";
+        if (!sizeOk || options.size <= 0 || !threadsOk || !weldOk || !(options.tolerance.value >= 0.0) ||
+            !parseRotation(parser.value(viewOption), options.rotate) ||
+            !parseElements(parser.value(elementsOption), options.showMask))
+        {
+            qWarning() << "Incorrect options of thumbnails";
+            parser.showHelp(1);
+        }
+        return renderThumbnails(options) > 0 ? 1 : 0;
+    }
+
     // Create MainWindow object
     MainWindow window;
 
@@ -3,10 +3,12 @@
 #include "mainWindow.h"
 #include "functions.h"
 #include "dialogbuildorientation.h"
+#include "meshcodec.h"
 #include <QMenuBar>
 #include <QMenu>
 #include <QMessageBox>
 #include <QtWidgets>
+#include <algorithm>
 #include <float.h>
 #include <math.h>
 
@@ -21,6 +23,18 @@ MainWindow::MainWindow()
     QMenu * menu = menuBar()->addMenu(tr("&File"));
     // create 'New Model' item
     menu->addAction(tr("New Model"), this, &MainWindow::openModel);
+    // create 'Save Compressed Model' item
+    m_actionSaveCompressed = menu->addAction(tr("Save Compressed Model"), this, &MainWindow::saveCompressedModel);
+    m_actionSaveCompressed->setEnabled(false);
+    // create 'Weld Tolerance' item
+    menu->addAction(tr("Weld Tolerance"), this, &MainWindow::editWeldTolerance);
+    menu->addSeparator();
+    // create 'Memory Report' item
+    menu->addAction(tr("Memory Report"), this, &MainWindow::showMemoryReport);
+    // create 'Culling Report' item
+    menu->addAction(tr("Culling Report"), this, &MainWindow::showCullingReport);
+    // create 'Frame Report' item
+    menu->addAction(tr("Frame Report"), this, &MainWindow::showFrameReport);
     menu->addSeparator();
     // create 'Quit' item
     menu->addAction(tr("&Quit"), this, &QWidget::close);
@@ -82,24 +96,64 @@ MainWindow::MainWindow()
     action->setChecked(true);
     action->setEnabled(false);
     connect(action, &QAction::toggled, this, &MainWindow::setDockOptions);
+    m_menuOptions->addSeparator();
+    // create the checker to free the buffers of hidden elements
+    action = m_menuOptions->addAction(tr("Free Hidden Buffers"));
+    action->setCheckable(true);
+    action->setChecked(false);
+    connect(action, &QAction::toggled, widget, &Scene3D::setReleaseHidden);
+    // create the checker to bake the build rotation on Shift release only
+    action = m_menuOptions->addAction(tr("Defer Build Rotation"));
+    action->setCheckable(true);
+    action->setChecked(true);
+    connect(action, &QAction::toggled, widget, &Scene3D::setDeferRotation);
+    // create the checkers to skip the clusters of triangles which are not seen
+    action = m_menuOptions->addAction(tr("Frustum Culling"));
+    action->setCheckable(true);
+    action->setChecked(true);
+    connect(action, &QAction::toggled, widget, &Scene3D::setFrustumCulling);
+    // the facets may be oriented inside, so the back faces are drawn by default
+    action = m_menuOptions->addAction(tr("Back-Face Culling"));
+    action->setCheckable(true);
+    action->setChecked(false);
+    connect(action, &QAction::toggled, widget, &Scene3D::setBackFaceCulling);
+
+    // create the tool bar to poligonize the model by the angle between facets interactively
+    QToolBar *toolBar = addToolBar(tr("Poligonize"));
+    toolBar->addWidget(new QLabel(tr("Face angle: "), toolBar));
+    m_angleSlider = new QSlider(Qt::Horizontal, toolBar);
+    m_angleSlider->setRange(0, 90);
+    m_angleSlider->setValue(POLIGONIZE_DEFAULT_ANGLE);
+    m_angleSlider->setEnabled(false);
+    toolBar->addWidget(m_angleSlider);
+    m_angleLabel = new QLabel(QString("%1 deg").arg(POLIGONIZE_DEFAULT_ANGLE), toolBar);
+    toolBar->addWidget(m_angleLabel);
+    connect(m_angleSlider, &QSlider::valueChanged, this, &MainWindow::poligonizeByAngle);
 
     statusBar()->addWidget(&m_statusLabel);
 
     m_lastOpenedDir = QDir::currentPath();
 }
 
+MainWindow::~MainWindow()
+{
+    stopLoading();
+    cancelLevelBuilding();
+    waitCacheWriting();
+}
+
 QString MainWindow::generateGroundString() const
 {
     return QString("Ground Value = %1 mm").arg(widget->groundValue());
 }
 
-// Open the STL file
+// Open the model file (STL, OBJ or PLY)
 void MainWindow::openModel()
 {
     // get the filename using the standard Qt file dialog
     QString fileName = QFileDialog::getOpenFileName(this, "Load",
                                                     m_lastOpenedDir.absolutePath(),
-                                                    "Models (*.stl)");
+                                                    "Models (*.stl *.obj *.ply *.cmsh)");
     if (fileName.isEmpty())
         return;
 
@@ -107,60 +161,237 @@ void MainWindow::openModel()
     m_lastOpenedDir = fInfo.absoluteDir();
 
     // extract the file extension
-    QString ext = fileName.right(3);
+    QString ext = fInfo.suffix();
+
+    // if the file is STL, OBJ, PLY or compressed model
+    if (QString::compare(ext, "stl", Qt::CaseInsensitive) == 0 ||
+        QString::compare(ext, "obj", Qt::CaseInsensitive) == 0 ||
+        QString::compare(ext, "ply", Qt::CaseInsensitive) == 0 ||
+        QString::compare(ext, "cmsh", Qt::CaseInsensitive) == 0)
+        startLoading(fileName);
+}
+
+// Save the current model in the compact quantized format
+void MainWindow::saveCompressedModel()
+{
+    bool ok;
+    int bits = QInputDialog::getInt(this, "Compressed Model", "Bits per coordinate",
+                                    CMESH_DEFAULT_BITS, CMESH_MIN_BITS, CMESH_MAX_BITS, 1, &ok);
+    if (!ok)
+        return;
 
-    // if the file is STL
-    if (QString::compare(ext, "stl", Qt::CaseInsensitive) == 0)
+    QString fileName = QFileDialog::getSaveFileName(this, "Save",
+                                                    m_lastOpenedDir.absolutePath(),
+                                                    "Compressed models (*.cmsh)");
+    if (fileName.isEmpty())
+        return;
+    if (QFileInfo(fileName).suffix().isEmpty())
+        fileName += ".cmsh";
+
+    std::vector<common::Vertex> vertices;
+    std::vector<common::Triangle> faces;
+    widget->getModel(vertices, faces);
+    if (!writeCompressedMesh(fileName, vertices, faces, bits))
+        QMessageBox::warning(nullptr, "ERROR!", "Unable to write the file " + fileName);
+}
+
+// Set the tolerance to merge the close vertices of the next loaded STL models
+void MainWindow::editWeldTolerance()
+{
+    const QStringList modes = {"Absolute [mm]", "Relative to the bounding box diagonal"};
+    bool ok;
+    QString mode = QInputDialog::getItem(this, "Weld Tolerance", "Tolerance", modes,
+                                         m_weldTolerance.relative ? 1 : 0, false, &ok);
+    if (!ok)
+        return;
+    bool relative = (mode == modes[1]);
+    double value = QInputDialog::getDouble(this, "Weld Tolerance", relative ? "[fraction]" : "[mm]",
+                                           m_weldTolerance.value, 0.0, relative ? 1.0 : 100.0, 8, &ok,
+                                           Qt::MSWindowsFixedSizeDialogHint);
+    if (!ok)
+        return;
+    m_weldTolerance.value = value;
+    m_weldTolerance.relative = relative;
+}
+
+// Load the model in the worker thread, the window stays responsive
+void MainWindow::startLoading(const QString &fileName)
+{
+    // the new file replaces the loading one, the scene keeps the state left by it
+    const bool wasLoading = (m_loadThread != nullptr);
+    stopLoading();
+    if (!wasLoading)
     {
-        std::vector<common::Vertex> vertices;
-        std::vector<common::Triangle> faces;
-
-        // check the type of STL (ascii or binary)
-        int type = getStlFileFormat(fileName);
-        if (type == STL_BINARY) {
-            if (!openStlBin(fileName.toLatin1().data(), vertices, faces)) {
-                QMessageBox::warning(nullptr, "ERROR!", "this STL file has incorrect format");
-                return;
+        m_previewShown = false;
+        m_levelsInterrupted = (m_levelThread != nullptr);
+    }
+    cancelLevelBuilding();
+    setActionsEnabled(false);
+
+    // the results of previous loadings are ignored by id
+    const uint64_t loadId = ++m_loadId;
+    auto control = std::make_shared<LoadControl>();
+
+    // report the progress in the status bar
+    control->progress = [this, loadId](int percent)
+    {
+        QMetaObject::invokeMethod(this, [this, loadId, percent]()
+        {
+            if (loadId == m_loadId)
+                m_statusLabel.setText(QString("Loading... %1% (Esc to cancel)").arg(percent));
+        }, Qt::QueuedConnection);
+    };
+
+    // show the subsample of facets while welding and topology are calculated
+    control->soupReady = [this, loadId](const std::vector<common::Vertex> &soup)
+    {
+        auto preview = std::make_shared<LoadedModel>();
+        makePreview(soup, preview->vertices, preview->faces);
+        QMetaObject::invokeMethod(this, [this, loadId, preview]()
+        {
+            if (loadId == m_loadId)
+            {
+                m_previewShown = true;
+                widget->setPreview(std::move(preview->vertices), std::move(preview->faces));
             }
-        } else
-        if (type == STL_ASCII) {
-            if (!openStlAsc(fileName.toLatin1().data(), vertices, faces)) {
-                QMessageBox::warning(nullptr, "ERROR!", "this STL file has incorrect format");
-                return;
+        }, Qt::QueuedConnection);
+    };
+
+    m_loadControl = control;
+    const WeldTolerance tolerance = m_weldTolerance;
+    m_loadThread = QThread::create([this, loadId, control, fileName, tolerance]()
+    {
+        auto model = std::make_shared<LoadedModel>();
+        StageMemoryScope memoryScope("load");
+
+        // use the model analyzed before if the file is not changed
+        model->cachePath = meshCachePath(fileName);
+        model->cacheKeyValid = meshCacheKey(fileName, tolerance, model->cacheKey);
+        if (model->cacheKeyValid && readMeshCache(model->cachePath, model->cacheKey, model->cache))
+        {
+            model->loaded = true;
+            model->fromCache = true;
+        }
+        else
+        {
+            model->loaded = loadModel(fileName, model->vertices, model->faces, model->error,
+                                      tolerance, control.get());
+            // the edges are independent on the scene, build them here too,
+            // the close triangles are put together first to cull them by clusters;
+            // both stop between their passes on Esc, so cancelLoading waits not long
+            if (model->loaded)
+            {
+                std::vector<uint32_t> permutation;
+                model->loaded =
+                    sortTrianglesSpatially(model->vertices, model->faces, 0, nullptr, control.get(), &permutation) &&
+                    buildEdges(model->faces, model->edges, model->triangleEdges, 0, nullptr, control.get());
+                // the orientation of triangles is fixed from the first facet of file
+                auto first = std::find(permutation.begin(), permutation.end(), 0u);
+                if (first != permutation.end())
+                    model->firstFacet = static_cast<uint32_t>(first - permutation.begin());
             }
-        } else {
-            QMessageBox msgBox;
-            msgBox.setText("The file is corrupt and cannot be loaded");
-            msgBox.setInformativeText("STL Load");
-            msgBox.setStandardButtons(QMessageBox::Ok);
-            msgBox.exec();
-            m_menuActions->actions()[0]->setEnabled(false);
-            m_menuActions->actions()[1]->setEnabled(false);
-            m_menuActions->actions()[2]->setEnabled(false);
-            // [3] skip separator
-            m_menuActions->actions()[4]->setEnabled(false);
-            m_menuActions->actions()[5]->setEnabled(false);
+        }
+
+        QMetaObject::invokeMethod(this, [this, loadId, model]()
+        {
+            finishLoading(loadId, *model);
+        }, Qt::QueuedConnection);
+    });
+    m_loadThread->start();
+
+    m_statusLabel.setText("Loading... (Esc to cancel)");
+}
+
+// Stop the loading thread (if any), the scene is not changed
+void MainWindow::stopLoading()
+{
+    if (m_loadThread == nullptr)
+        return;
+
+    // every stage of the loader checks the flag between its passes, so the wait is short
+    m_loadControl->cancelled = true;
+    m_loadThread->wait();
+    delete m_loadThread;
+    m_loadThread = nullptr;
+    m_loadControl.reset();
+    // skip the queued events of the cancelled loading
+    ++m_loadId;
+}
+
+// Stop the loading model (if any) by the user
+void MainWindow::cancelLoading()
+{
+    if (m_loadThread == nullptr)
+        return;
+
+    stopLoading();
+    abortLoading();
+    m_statusLabel.setText("Loading cancelled");
+}
+
+// The loading failed or was cancelled: the preview is cleared, the previous model is used further
+void MainWindow::abortLoading()
+{
+    if (m_previewShown)
+    {
+        // the previous model is replaced already, the actions stay disabled
+        widget->setPreview({}, {});
+        return;
+    }
+
+    // the previous model is untouched (if any)
+    if (!widget->triangles().empty())
+    {
+        setActionsEnabled(true);
+        if (m_levelsInterrupted)
+            startLevelBuilding();
+    }
+}
+
+void MainWindow::finishLoading(uint64_t loadId, LoadedModel &model)
+{
+    if (loadId != m_loadId)
+        return;
+
+    // the thread has already finished its work
+    m_loadThread->wait();
+    delete m_loadThread;
+    m_loadThread = nullptr;
+    m_loadControl.reset();
+
+    if (!model.loaded)
+    {
+        abortLoading();
+        m_statusLabel.clear();
+        QMessageBox::warning(nullptr, "ERROR!", model.error);
+        return;
+    }
+
+    if (model.fromCache)
+    {
+        if (!widget->setModel(std::move(model.cache)))
+        {
+            m_statusLabel.clear();
+            QMessageBox::warning(nullptr, "ERROR!", "Incorrect format of the model!");
             return;
         }
-        if (!widget->setModel(std::move(vertices), std::move(faces)) ||
-            !widget->updateAll()) {
-            m_menuActions->actions()[0]->setEnabled(false);
-            m_menuActions->actions()[1]->setEnabled(false);
-            m_menuActions->actions()[2]->setEnabled(false);
-            // [3] skip separator
-            m_menuActions->actions()[4]->setEnabled(false);
-            m_menuActions->actions()[5]->setEnabled(false);
+    }
+    else
+    {
+        if (!widget->setModel(std::move(model.vertices), std::move(model.faces)) ||
+            !widget->updateAll(std::move(model.edges), std::move(model.triangleEdges), model.firstFacet)) {
+            m_statusLabel.clear();
             QMessageBox::warning(nullptr, "ERROR!", "Incorrect format of the model!");
             return;
         }
+
+        // store the analyzed model for the next opening
+        if (model.cacheKeyValid)
+            storeCache(model.cachePath, model.cacheKey);
     }
 
-    m_menuActions->actions()[0]->setEnabled(true);
-    m_menuActions->actions()[1]->setEnabled(true);
-    m_menuActions->actions()[2]->setEnabled(true);
-    // [3] skip separator
-    m_menuActions->actions()[4]->setEnabled(true);
-    m_menuActions->actions()[5]->setEnabled(true);
+    setActionsEnabled(true);
+    startLevelBuilding();
 
     // enable and set on 'Axis' checker
     m_menuOptions->actions()[0]->setChecked(true);
@@ -184,6 +415,118 @@ void MainWindow::openModel()
     m_statusLabel.setText(generateGroundString());
 }
 
+// Take every n-th valid facet of loading model to show it as preview
+void MainWindow::makePreview(const std::vector<common::Vertex> &soup,
+                             std::vector<common::Vertex> &vertices,
+                             std::vector<common::Triangle> &faces)
+{
+    size_t nTriangles = soup.size() / 3;
+    size_t step = std::max<size_t>(1, nTriangles / PREVIEW_TRIANGLES);
+    vertices.reserve(3 * (nTriangles / step + 1));
+    faces.reserve(nTriangles / step + 1);
+    for (size_t i = 0; i < nTriangles; i += step)
+    {
+        // skip the degenerated facets, their normals are undefined
+        common::Vector nor;
+        calculateNormal(soup[3*i], soup[3*i + 1], soup[3*i + 2], nor);
+        if (!normalize(nor))
+            continue;
+
+        uint32_t index = static_cast<uint32_t>(vertices.size());
+        vertices.push_back(soup[3*i]);
+        vertices.push_back(soup[3*i + 1]);
+        vertices.push_back(soup[3*i + 2]);
+        faces.push_back({index, index + 1, index + 2});
+    }
+}
+
+// Write the cache of current model in the background
+void MainWindow::storeCache(const QString &cachePath, const MeshCacheKey &key)
+{
+    waitCacheWriting();
+
+    auto data = std::make_shared<MeshCacheData>();
+    widget->getCacheData(*data);
+    m_cacheThread = QThread::create([cachePath, key, data]()
+    {
+        if (!writeMeshCache(cachePath, key, *data))
+            qDebug() << "Unable to write the mesh cache" << cachePath;
+    });
+    m_cacheThread->start();
+}
+
+void MainWindow::waitCacheWriting()
+{
+    if (m_cacheThread == nullptr)
+        return;
+    m_cacheThread->wait();
+    delete m_cacheThread;
+    m_cacheThread = nullptr;
+}
+
+// Simplify the model in the background to draw it while the view is changed
+void MainWindow::startLevelBuilding()
+{
+    cancelLevelBuilding();
+    if (widget->triangles().size() <= LOD_INTERACTIVE_TRIANGLES)
+        return;
+
+    // the thread works on the copy, the scene changes its model meanwhile
+    auto model = std::make_shared<common::MeshLevel>();
+    model->vertices = widget->verticesOrig();
+    model->triangles = widget->triangles();
+    const uint64_t loadId = m_loadId;
+    auto control = std::make_shared<LoadControl>();
+
+    m_levelControl = control;
+    m_levelThread = QThread::create([this, loadId, control, model]()
+    {
+        auto levels = std::make_shared<std::vector<common::MeshLevel>>();
+        bool built = buildMeshLevels(model->vertices, model->triangles, *levels,
+                                     LOD_LEVELS, LOD_FACTOR, control.get());
+        *model = common::MeshLevel();
+
+        QMetaObject::invokeMethod(this, [this, loadId, built, levels]()
+        {
+            // the building of another model
+            if (loadId != m_loadId || m_levelThread == nullptr)
+                return;
+
+            m_levelThread->wait();
+            delete m_levelThread;
+            m_levelThread = nullptr;
+            m_levelControl.reset();
+            if (built)
+                widget->setLevels(std::move(*levels));
+        }, Qt::QueuedConnection);
+    });
+    m_levelThread->start();
+}
+
+void MainWindow::cancelLevelBuilding()
+{
+    if (m_levelThread == nullptr)
+        return;
+
+    m_levelControl->cancelled = true;
+    m_levelThread->wait();
+    delete m_levelThread;
+    m_levelThread = nullptr;
+    m_levelControl.reset();
+}
+
+void MainWindow::setActionsEnabled(bool enabled)
+{
+    m_actionSaveCompressed->setEnabled(enabled);
+    m_angleSlider->setEnabled(enabled);
+    m_menuActions->actions()[0]->setEnabled(enabled);
+    m_menuActions->actions()[1]->setEnabled(enabled);
+    m_menuActions->actions()[2]->setEnabled(enabled);
+    // [3] skip separator
+    m_menuActions->actions()[4]->setEnabled(enabled);
+    m_menuActions->actions()[5]->setEnabled(enabled);
+}
+
 // Create the 'elements visibility' variable according to checkers of 'Elements' menu
 void MainWindow::setDockOptions()
 {
@@ -209,9 +552,97 @@ void MainWindow::setDockOptions()
         widget->showMask() |= shGround;
 
     // update the showed elements
+    widget->updateVisibility();
     widget->update();
 }
 
+namespace {
+
+QString formatBytes(size_t bytes)
+{
+    return QString::number(bytes / 1048576.0, 'f', 2) + " MB";
+}
+
+}
+
+// Show the memory of model buffers and pipeline stages, the report is dumped to the log too
+void MainWindow::showMemoryReport()
+{
+    std::vector<Scene3D::BufferMemory> buffers;
+    widget->memoryReport(buffers);
+
+    QString report = QString("%1 %2 %3\n").arg("Buffer", -26).arg("Size", 12).arg("Capacity", 12);
+    size_t totalSize = 0;
+    size_t totalCapacity = 0;
+    for (const Scene3D::BufferMemory &buffer : buffers)
+    {
+        report += QString("%1 %2 %3\n").arg(buffer.name, -26)
+                .arg(formatBytes(buffer.size), 12).arg(formatBytes(buffer.capacity), 12);
+        totalSize += buffer.size;
+        totalCapacity += buffer.capacity;
+    }
+    report += QString("%1 %2 %3\n\n").arg("Total", -26)
+            .arg(formatBytes(totalSize), 12).arg(formatBytes(totalCapacity), 12);
+
+    report += QString("%1 %2 %3 %4\n").arg("Stage", -26).arg("Before", 12).arg("After", 12).arg("Peak", 12);
+    for (const StageMemory &stage : stageMemoryLog())
+    {
+        report += QString("%1 %2 %3 %4\n").arg(stage.stage, -26).arg(formatBytes(stage.before), 12)
+                .arg(formatBytes(stage.after), 12).arg(formatBytes(stage.peak), 12);
+    }
+    report += QString("\nResident memory: %1, peak: %2\n")
+            .arg(formatBytes(residentMemory())).arg(formatBytes(peakResidentMemory()));
+
+    qDebug().noquote() << report;
+
+    QDialog dialog(this);
+    dialog.setWindowTitle("Memory Report");
+    QVBoxLayout *layout = new QVBoxLayout(&dialog);
+    QPlainTextEdit *text = new QPlainTextEdit(report, &dialog);
+    text->setReadOnly(true);
+    text->setFont(QFontDatabase::systemFont(QFontDatabase::FixedFont));
+    text->setMinimumSize(560, 520);
+    layout->addWidget(text);
+    QDialogButtonBox *buttons = new QDialogButtonBox(QDialogButtonBox::Close, &dialog);
+    connect(buttons, &QDialogButtonBox::rejected, &dialog, &QDialog::reject);
+    layout->addWidget(buttons);
+    dialog.exec();
+}
+
+// Show the clusters and the triangles culled by the last frame, the report is dumped to the log too
+void MainWindow::showCullingReport()
+{
+    const Scene3D::CullStats &stats = widget->cullStats();
+    QString report = QString("Clusters: %1 (out of view: %2, back-facing: %3)\n"
+                             "Triangles submitted: %4, culled: %5\n"
+                             "Edges submitted: %6, culled: %7")
+            .arg(stats.clusters).arg(stats.frustumCulled).arg(stats.backFaceCulled)
+            .arg(stats.submittedTriangles).arg(stats.culledTriangles)
+            .arg(stats.submittedEdges).arg(stats.culledEdges);
+
+    qDebug().noquote() << report;
+    QMessageBox::information(this, "Culling Report", report);
+}
+
+void MainWindow::showFrameReport()
+{
+    const Scene3D::FrameStats &stats = widget->frameStats();
+    const double frames = std::max<size_t>(stats.frames, 1);
+    QString report = QString("Input events: %1, frames: %2, skipped: %3\n"
+                             "Frame time: last %4 ms, mean %5 ms, max %6 ms\n"
+                             "Input to frame: last %7 ms, mean %8 ms, max %9 ms")
+            .arg(stats.inputEvents).arg(stats.frames).arg(stats.skippedFrames)
+            .arg(stats.lastFrameMs, 0, 'f', 2).arg(stats.totalFrameMs / frames, 0, 'f', 2)
+            .arg(stats.maxFrameMs, 0, 'f', 2)
+            .arg(stats.lastLatencyMs, 0, 'f', 2).arg(stats.totalLatencyMs / frames, 0, 'f', 2)
+            .arg(stats.maxLatencyMs, 0, 'f', 2);
+
+    qDebug().noquote() << report;
+    QMessageBox::information(this, "Frame Report", report);
+    // the next report shows the frames after this one
+    widget->resetFrameStats();
+}
+
 void MainWindow::changeOrientation()
 {
     widget->changeOrientation();
@@ -220,9 +651,17 @@ void MainWindow::changeOrientation()
 
 void MainWindow::poligonize()
 {
+    // the default cosine of Scene3D
     widget->poligonize();
 }
 
+void MainWindow::poligonizeByAngle()
+{
+    int angle = m_angleSlider->value();
+    m_angleLabel->setText(QString("%1 deg").arg(angle));
+    widget->poligonize(cos(angle * M_PI / 180.0));
+}
+
 void MainWindow::detectSupportedTriangles()
 {
     double area = widget->detectSupportedTriangles();
@@ -262,7 +701,7 @@ void MainWindow::modifyBuildDirection()
         widget->applyModelRotation();
         widget->fitModel();
         widget->updateAll();
-        widget->updateGL();
+        widget->update();
     }
 }
 
@@ -271,6 +710,7 @@ void MainWindow::keyPressEvent(QKeyEvent *pe)
     switch (pe->key())
     {
     case Qt::Key_N: openModel(); break;
+    case Qt::Key_Escape: cancelLoading(); break;
     default: widget->keyPressEvent(pe); break;
     }
 }
@@ -3,8 +3,21 @@
 #include <QMainWindow>
 #include <QLabel>
 #include <QDir>
+#include <QThread>
+#include <memory>
+#include <vector>
+#include "common.h"
+#include "meshcache.h"
+
+// the maximum number of facets shown while the model is loading
+#define PREVIEW_TRIANGLES 200000
+// the default angle of the slider between the normals of neighbor triangles in one face
+// (cos 26 deg = 0.899, the 'Poligonize' action and 'P' key use the cosine 0.9 exactly)
+#define POLIGONIZE_DEFAULT_ANGLE 26
 
 class Scene3D;
+class QSlider;
+struct LoadControl;
 
 class MainWindow : public QMainWindow
 {
@@ -12,20 +25,71 @@ class MainWindow : public QMainWindow
 
 public:
 	MainWindow();
+    ~MainWindow() override;
     Scene3D *widget;    // Qt widget to show the 3D objects
     QMenu *m_menuActions; // 'Process' menu
     QMenu *m_menuOptions; // 'Elements' menu
+    QAction *m_actionSaveCompressed; // 'Save Compressed Model' item
+    QSlider *m_angleSlider; // the angle of poligonization (degrees)
+    QLabel *m_angleLabel;
     QDir m_lastOpenedDir;
     QLabel m_statusLabel;
+    WeldTolerance m_weldTolerance; // the welding of the next loaded models
 
 private:
+    // the result of loading thread
+    struct LoadedModel
+    {
+        bool loaded = false;
+        QString error;
+        std::vector<common::Vertex> vertices;
+        std::vector<common::Triangle> faces;
+        uint32_t firstFacet = 0;    // the first facet of file after the spatial sort
+        std::vector<common::Edge> edges;
+        std::vector<uint32_t> triangleEdges;
+        // the cache of the model file
+        QString cachePath;
+        MeshCacheKey cacheKey;
+        bool cacheKeyValid = false;
+        bool fromCache = false;
+        MeshCacheData cache;
+    };
+
+    QThread *m_loadThread = nullptr;
+    QThread *m_cacheThread = nullptr;
+    std::shared_ptr<LoadControl> m_loadControl;
+    uint64_t m_loadId = 0;
+    bool m_previewShown = false;      // the preview of loading model has replaced the scene
+    bool m_levelsInterrupted = false; // the levels of the scene model were not built by the loading
+    QThread *m_levelThread = nullptr;
+    std::shared_ptr<LoadControl> m_levelControl;
+
     QString generateGroundString() const;
+    void startLoading(const QString &fileName);
+    void stopLoading();
+    void cancelLoading();
+    void abortLoading();
+    void finishLoading(uint64_t loadId, LoadedModel &model);
+    void setActionsEnabled(bool enabled);
+    void storeCache(const QString &cachePath, const MeshCacheKey &key);
+    void waitCacheWriting();
+    void startLevelBuilding();
+    void cancelLevelBuilding();
+    static void makePreview(const std::vector<common::Vertex> &soup,
+                            std::vector<common::Vertex> &vertices,
+                            std::vector<common::Triangle> &faces);
 
 private slots:
 	void openModel();
+    void saveCompressedModel();
+    void editWeldTolerance();
+    void showMemoryReport();
+    void showCullingReport();
+    void showFrameReport();
 	void setDockOptions();
     void changeOrientation();
     void poligonize();
+    void poligonizeByAngle();
     void detectSupportedTriangles();
     void editGroundHeight();
     void modifyBuildDirection();
@@ -0,0 +1,259 @@
+#include "meshcache.h"
+#include "functions.h"
+#include <QFileInfo>
+#include <QDateTime>
+#include <QDir>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <QDebug>
+#include <string.h>
+
+namespace {
+
+// the number of arrays stored in the cache
+const int cacheArrays = 8;
+
+// the header of cache file, the arrays follow it in the order of MeshCacheData fields,
+// each array starts at the 8 bytes boundary
+struct MeshCacheHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t headerSize;
+    MeshCacheKey key;
+    double center[3];
+    uint64_t firstFacet;
+    uint64_t counts[cacheArrays];
+};
+
+const char cacheMagic[8] = {'3', 'D', 'V', 'C', 'A', 'C', 'H', 'E'};
+
+// the size of block of the source file included into the content hash
+const uint64_t hashBlockSize = 4096;
+// the number of blocks included into the content hash
+const uint64_t hashBlocks = 64;
+
+// FNV-1a hash of bytes
+uint64_t hashBytes(uint64_t hash, const uchar *data, uint64_t size)
+{
+    for (uint64_t i = 0; i < size; ++i)
+    {
+        hash ^= data[i];
+        hash *= 0x100000001B3ull;
+    }
+    return hash;
+}
+
+inline uint64_t align8(uint64_t size)
+{
+    return (size + 7) & ~static_cast<uint64_t>(7);
+}
+
+template <class T>
+bool readArray(const uchar *&pos, const uchar *end, uint64_t count, std::vector<T> &array)
+{
+    // the count of damaged file can overflow the size in bytes, and the padding
+    // must not move the position past the end
+    const uint64_t left = static_cast<uint64_t>(end - pos);
+    if (count > left / sizeof(T))
+        return false;
+    uint64_t bytes = count * sizeof(T);
+    if (align8(bytes) > left)
+        return false;
+    array.resize(count);
+    memcpy(array.data(), pos, bytes);
+    pos += align8(bytes);
+    return true;
+}
+
+template <class T>
+bool writeArray(QSaveFile &file, const std::vector<T> &array)
+{
+    static const char padding[8] = {};
+    qint64 bytes = static_cast<qint64>(array.size() * sizeof(T));
+    if (file.write(reinterpret_cast<const char*>(array.data()), bytes) != bytes)
+        return false;
+    qint64 pad = static_cast<qint64>(align8(bytes)) - bytes;
+    return file.write(padding, pad) == pad;
+}
+
+// check the indices don't go out of arrays (the cache file could be damaged)
+bool checkMeshCache(const MeshCacheData &data)
+{
+    const size_t nVertices = data.vertices.size();
+    const size_t nTriangles = data.triangles.size();
+    const size_t nEdges = data.edges.size();
+
+    if (data.firstFacet >= nTriangles ||
+        data.triangleEdges.size() != 3 * nTriangles ||
+        data.edgeTriangleOffsets.size() != nEdges + 1 ||
+        data.normals.size() != nTriangles ||
+        data.triangleArea.size() != nTriangles)
+        return false;
+
+    for (const common::Triangle &tri : data.triangles)
+        for (uint32_t index : tri.coord)
+            if (index >= nVertices)
+                return false;
+    for (const common::Edge &edge : data.edges)
+        for (uint32_t index : edge.coord)
+            if (index >= nVertices)
+                return false;
+    for (uint32_t index : data.triangleEdges)
+        if (index >= nEdges)
+            return false;
+    for (uint32_t index : data.edgeTriangles)
+        if (index >= nTriangles)
+            return false;
+
+    if (data.edgeTriangleOffsets.front() != 0 ||
+        data.edgeTriangleOffsets.back() != data.edgeTriangles.size())
+        return false;
+    for (size_t i = 0; i < nEdges; ++i)
+        if (data.edgeTriangleOffsets[i] > data.edgeTriangleOffsets[i + 1])
+            return false;
+    return true;
+}
+
+}
+
+bool meshCacheKey(const QString &path, const WeldTolerance &tolerance, MeshCacheKey &key)
+{
+    // input variables:
+    // path - the path of model file
+    // tolerance - the welding of loader
+
+    MappedFile file;
+    if (!file.open(path))
+        return false;
+
+    key.fileSize = file.size();
+    key.modified = QFileInfo(path).lastModified().toMSecsSinceEpoch();
+    key.weldTolerance = tolerance.value;
+    key.weldRelative = tolerance.relative ? 1 : 0;
+
+    // hash the blocks spread evenly over the file, reading the whole file
+    // would take the time comparable with loading
+    uint64_t hash = 0xCBF29CE484222325ull;
+    if (file.size() <= hashBlockSize * hashBlocks)
+    {
+        hash = hashBytes(hash, file.data(), file.size());
+    }
+    else
+    {
+        uint64_t step = (file.size() - hashBlockSize) / (hashBlocks - 1);
+        for (uint64_t i = 0; i < hashBlocks; ++i)
+            hash = hashBytes(hash, file.data() + i * step, hashBlockSize);
+    }
+    key.contentHash = hash;
+    return true;
+}
+
+QString meshCachePath(const QString &path)
+{
+    QString absolutePath = QFileInfo(path).absoluteFilePath();
+    QByteArray bytes = absolutePath.toUtf8();
+    uint64_t hash = hashBytes(0xCBF29CE484222325ull,
+                              reinterpret_cast<const uchar*>(bytes.constData()),
+                              static_cast<uint64_t>(bytes.size()));
+
+    QString dir = QStandardPaths::writableLocation(QStandardPaths::CacheLocation);
+    return QString("%1/meshes/%2.3dvcache").arg(dir).arg(static_cast<qulonglong>(hash), 16, 16, QChar('0'));
+}
+
+bool readMeshCache(const QString &cachePath, const MeshCacheKey &key, MeshCacheData &data)
+{
+    // input variables:
+    // cachePath - the path of cache file
+    // key - the key of source file, the cache is used if the keys match
+
+    if (!QFileInfo::exists(cachePath))
+        return false;
+
+    MappedFile file;
+    if (!file.open(cachePath) || file.size() < align8(sizeof(MeshCacheHeader)))
+        return false;
+    file.adviseSequential();
+
+    MeshCacheHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 ||
+        header.version != MESH_CACHE_VERSION ||
+        header.headerSize != sizeof(MeshCacheHeader) ||
+        header.key.fileSize != key.fileSize ||
+        header.key.modified != key.modified ||
+        header.key.contentHash != key.contentHash ||
+        header.key.weldTolerance != key.weldTolerance ||
+        header.key.weldRelative != key.weldRelative)
+        return false;
+
+    // the arrays are copied from the mapping as they are, no parsing is needed
+    const uchar *pos = file.data() + align8(sizeof(MeshCacheHeader));
+    const uchar *end = file.data() + file.size();
+    data.center = {header.center[0], header.center[1], header.center[2]};
+    if (header.firstFacet > UINT32_MAX)
+        return false;
+    data.firstFacet = static_cast<uint32_t>(header.firstFacet);
+    const uint64_t *counts = header.counts;
+    if (!readArray(pos, end, counts[0], data.vertices) ||
+        !readArray(pos, end, counts[1], data.triangles) ||
+        !readArray(pos, end, counts[2], data.edges) ||
+        !readArray(pos, end, counts[3], data.triangleEdges) ||
+        !readArray(pos, end, counts[4], data.edgeTriangleOffsets) ||
+        !readArray(pos, end, counts[5], data.edgeTriangles) ||
+        !readArray(pos, end, counts[6], data.normals) ||
+        !readArray(pos, end, counts[7], data.triangleArea) ||
+        !checkMeshCache(data))
+    {
+        qDebug() << "The mesh cache is damaged:" << cachePath;
+        data = MeshCacheData();
+        return false;
+    }
+    return true;
+}
+
+bool writeMeshCache(const QString &cachePath, const MeshCacheKey &key, const MeshCacheData &data)
+{
+    QDir().mkpath(QFileInfo(cachePath).absolutePath());
+
+    // the file is replaced at once when everything is written
+    QSaveFile file(cachePath);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+
+    MeshCacheHeader header = {};
+    memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+    header.version = MESH_CACHE_VERSION;
+    header.headerSize = sizeof(MeshCacheHeader);
+    header.key = key;
+    header.center[0] = data.center.x;
+    header.center[1] = data.center.y;
+    header.center[2] = data.center.z;
+    header.firstFacet = data.firstFacet;
+    header.counts[0] = data.vertices.size();
+    header.counts[1] = data.triangles.size();
+    header.counts[2] = data.edges.size();
+    header.counts[3] = data.triangleEdges.size();
+    header.counts[4] = data.edgeTriangleOffsets.size();
+    header.counts[5] = data.edgeTriangles.size();
+    header.counts[6] = data.normals.size();
+    header.counts[7] = data.triangleArea.size();
+
+    static const char padding[8] = {};
+    qint64 headerPad = static_cast<qint64>(align8(sizeof(header)) - sizeof(header));
+    if (file.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header) ||
+        file.write(padding, headerPad) != headerPad ||
+        !writeArray(file, data.vertices) ||
+        !writeArray(file, data.triangles) ||
+        !writeArray(file, data.edges) ||
+        !writeArray(file, data.triangleEdges) ||
+        !writeArray(file, data.edgeTriangleOffsets) ||
+        !writeArray(file, data.edgeTriangles) ||
+        !writeArray(file, data.normals) ||
+        !writeArray(file, data.triangleArea))
+    {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include "common.h"
+#include "functions.h"
+#include <QString>
+#include <vector>
+
+// the version of cache layout, the caches of other versions are ignored
+#define MESH_CACHE_VERSION 5
+
+// identification of the source file which the cache is built from
+struct MeshCacheKey
+{
+    uint64_t fileSize = 0;
+    int64_t modified = 0;     // the time of last modification (ms since epoch)
+    uint64_t contentHash = 0; // the hash of sampled blocks of the file
+    // the welding of loader, the model welded by another tolerance is not used
+    double weldTolerance = 0.0;
+    uint64_t weldRelative = 0;
+};
+
+// the loaded and analyzed model (as Scene3D keeps it right after loading)
+struct MeshCacheData
+{
+    common::Vertex                center;   // the vertices are relative to it
+    std::vector<common::VertexF>  vertices;
+    std::vector<common::Triangle> triangles;
+    uint32_t                      firstFacet = 0; // the triangle which is the first facet of file
+    std::vector<common::Edge>     edges;
+    std::vector<uint32_t>         triangleEdges;
+    // the edge-triangle connector: the triangles of edge i are
+    // edgeTriangles[edgeTriangleOffsets[i]] .. edgeTriangles[edgeTriangleOffsets[i + 1] - 1]
+    std::vector<uint32_t>         edgeTriangleOffsets;
+    std::vector<uint32_t>         edgeTriangles;
+    std::vector<common::PackedNormal> normals;
+    std::vector<float>            triangleArea;
+};
+
+// calculate the key of file loaded by the tolerance, return false if the file is not readable
+bool meshCacheKey(const QString &path, const WeldTolerance &tolerance, MeshCacheKey &key);
+// the path of cache file for the model file (in the user's cache directory)
+QString meshCachePath(const QString &path);
+// read the cache, return false if it doesn't exist or doesn't match the key
+bool readMeshCache(const QString &cachePath, const MeshCacheKey &key, MeshCacheData &data);
+bool writeMeshCache(const QString &cachePath, const MeshCacheKey &key, const MeshCacheData &data);
@@ -0,0 +1,331 @@
+#include "meshcodec.h"
+#include "functions.h"
+#include <QSaveFile>
+#include <QByteArray>
+#include <algorithm>
+#include <float.h>
+#include <math.h>
+#include <string.h>
+
+namespace {
+
+// the header of compressed mesh, the vertex and the index streams follow it
+struct CompressedMeshHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t bits;
+    uint64_t nVertices;
+    uint64_t nTriangles;
+    double boxMin[3];
+    double boxMax[3];
+};
+
+const char meshMagic[8] = {'3', 'D', 'V', 'C', 'M', 'E', 'S', 'H'};
+
+// the size of raw stream part compressed at once
+const size_t streamBlockSize = 64 << 20;
+// deflate can't compress the data more than 1032 times
+const uint64_t maxDeflateRatio = 1032;
+
+inline void writeVarint(std::vector<uchar> &stream, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        stream.push_back(static_cast<uchar>(value | 0x80));
+        value >>= 7;
+    }
+    stream.push_back(static_cast<uchar>(value));
+}
+
+inline bool readVarint(const uchar *&pos, const uchar *end, uint64_t &value)
+{
+    value = 0;
+    for (int shift = 0; shift < 64 && pos < end; shift += 7)
+    {
+        uchar byte = *pos++;
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+inline uint64_t zigzag(int64_t value)
+{
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+inline int64_t unzigzag(uint64_t value)
+{
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// the stream: raw size, number of blocks, then the deflated blocks with their sizes
+bool writeStream(QSaveFile &file, const std::vector<uchar> &stream)
+{
+    uint64_t rawSize = stream.size();
+    uint64_t nBlocks = (rawSize + streamBlockSize - 1) / streamBlockSize;
+    if (file.write(reinterpret_cast<const char*>(&rawSize), sizeof(rawSize)) != sizeof(rawSize) ||
+        file.write(reinterpret_cast<const char*>(&nBlocks), sizeof(nBlocks)) != sizeof(nBlocks))
+        return false;
+
+    for (uint64_t i = 0; i < nBlocks; ++i)
+    {
+        size_t offset = i * streamBlockSize;
+        int size = static_cast<int>(std::min(streamBlockSize, stream.size() - offset));
+        QByteArray block = qCompress(stream.data() + offset, size, 6);
+        uint32_t blockSize = static_cast<uint32_t>(block.size());
+        if (file.write(reinterpret_cast<const char*>(&blockSize), sizeof(blockSize)) != sizeof(blockSize) ||
+            file.write(block.constData(), block.size()) != block.size())
+            return false;
+    }
+    return true;
+}
+
+bool readStream(const uchar *&pos, const uchar *end, std::vector<uchar> &stream)
+{
+    uint64_t rawSize;
+    uint64_t nBlocks;
+    if (static_cast<size_t>(end - pos) < sizeof(rawSize) + sizeof(nBlocks))
+        return false;
+    memcpy(&rawSize, pos, sizeof(rawSize));
+    memcpy(&nBlocks, pos + sizeof(rawSize), sizeof(nBlocks));
+    pos += sizeof(rawSize) + sizeof(nBlocks);
+    // the sizes of damaged file are not trusted before the allocation
+    if (rawSize > static_cast<uint64_t>(end - pos) * maxDeflateRatio ||
+        nBlocks != (rawSize + streamBlockSize - 1) / streamBlockSize)
+        return false;
+
+    // the stream grows by the blocks really read
+    stream.clear();
+    size_t offset = 0;
+    for (uint64_t i = 0; i < nBlocks; ++i)
+    {
+        uint32_t blockSize;
+        if (static_cast<size_t>(end - pos) < sizeof(blockSize))
+            return false;
+        memcpy(&blockSize, pos, sizeof(blockSize));
+        pos += sizeof(blockSize);
+        if (static_cast<size_t>(end - pos) < blockSize)
+            return false;
+
+        QByteArray block = qUncompress(pos, static_cast<int>(blockSize));
+        pos += blockSize;
+        size_t expected = std::min<uint64_t>(streamBlockSize, rawSize - offset);
+        if (static_cast<size_t>(block.size()) != expected)
+            return false;
+        stream.insert(stream.end(), block.constData(), block.constData() + expected);
+        offset += expected;
+    }
+    return true;
+}
+
+}
+
+bool writeCompressedMesh(const QString &path, const std::vector<common::Vertex> &vertices,
+                         const std::vector<common::Triangle> &faces, int bits)
+{
+    // input variables:
+    // path - the path of file to write
+    // bits - the number of bits per quantized coordinate (CMESH_MIN_BITS..CMESH_MAX_BITS)
+
+    if (bits < CMESH_MIN_BITS || bits > CMESH_MAX_BITS || faces.empty())
+        return false;
+
+    // order the vertices by their first use in facets, so the new vertex is always
+    // the next one and the index stream keeps mostly small numbers
+    const uint32_t noIndex = UINT32_MAX;
+    std::vector<uint32_t> remap(vertices.size(), noIndex);
+    std::vector<uint32_t> order;
+    order.reserve(vertices.size());
+    std::vector<uchar> indexStream;
+    indexStream.reserve(3 * faces.size());
+    for (const common::Triangle &tri : faces)
+    {
+        for (uint32_t index : tri.coord)
+        {
+            if (index >= vertices.size())
+                return false;
+            uint32_t &newIndex = remap[index];
+            if (newIndex == noIndex)
+            {
+                // the new vertex is coded as zero
+                newIndex = static_cast<uint32_t>(order.size());
+                order.push_back(index);
+                writeVarint(indexStream, 0);
+            }
+            else
+            {
+                // the used vertex is coded by the distance back from the next new one
+                writeVarint(indexStream, order.size() - newIndex);
+            }
+        }
+    }
+
+    // quantize the vertices to the grid over the bounding box
+    CompressedMeshHeader header = {};
+    memcpy(header.magic, meshMagic, sizeof(meshMagic));
+    header.version = CMESH_VERSION;
+    header.bits = static_cast<uint32_t>(bits);
+    header.nVertices = order.size();
+    header.nTriangles = faces.size();
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        header.boxMin[axis] = DBL_MAX;
+        header.boxMax[axis] = -DBL_MAX;
+    }
+    for (uint32_t index : order)
+    {
+        const common::Vertex &p = vertices[index];
+        const double coords[3] = {p.x, p.y, p.z};
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            header.boxMin[axis] = std::min(header.boxMin[axis], coords[axis]);
+            header.boxMax[axis] = std::max(header.boxMax[axis], coords[axis]);
+        }
+    }
+
+    const double steps = static_cast<double>((1u << bits) - 1);
+    double scale[3];
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        double extent = header.boxMax[axis] - header.boxMin[axis];
+        scale[axis] = extent > 0.0 ? steps / extent : 0.0;
+    }
+
+    // the quantized coordinates are coded by the difference with the previous vertex
+    std::vector<uchar> vertexStream;
+    vertexStream.reserve(3 * order.size());
+    int64_t prev[3] = {0, 0, 0};
+    for (uint32_t index : order)
+    {
+        const common::Vertex &p = vertices[index];
+        const double coords[3] = {p.x, p.y, p.z};
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            int64_t q = llround((coords[axis] - header.boxMin[axis]) * scale[axis]);
+            writeVarint(vertexStream, zigzag(q - prev[axis]));
+            prev[axis] = q;
+        }
+    }
+
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return false;
+    if (file.write(reinterpret_cast<const char*>(&header), sizeof(header)) != sizeof(header) ||
+        !writeStream(file, vertexStream) ||
+        !writeStream(file, indexStream))
+    {
+        file.cancelWriting();
+        return false;
+    }
+    return file.commit();
+}
+
+bool openCompressedMesh(const MappedFile &file, std::vector<common::Vertex> &vertices,
+                        std::vector<common::Triangle> &faces, LoadControl *control)
+{
+    // input variables:
+    // file - the mapped file to load
+    // control - the progress and cancellation of loading (optional)
+
+    file.adviseSequential();
+    vertices.clear();
+    faces.clear();
+
+    CompressedMeshHeader header;
+    if (file.size() < sizeof(header))
+        return false;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, meshMagic, sizeof(meshMagic)) != 0 ||
+        header.version != CMESH_VERSION ||
+        header.bits < CMESH_MIN_BITS || header.bits > CMESH_MAX_BITS)
+        return false;
+
+    const uchar *pos = file.data() + sizeof(header);
+    const uchar *end = file.data() + file.size();
+    std::vector<uchar> vertexStream;
+    std::vector<uchar> indexStream;
+    if (!readStream(pos, end, vertexStream))
+        return false;
+    if (control != nullptr)
+    {
+        if (control->isCancelled())
+            return false;
+        control->report(LoadControl::Read, 1, 4);
+    }
+    if (!readStream(pos, end, indexStream))
+        return false;
+    if (control != nullptr)
+    {
+        if (control->isCancelled())
+            return false;
+        control->report(LoadControl::Read, 2, 4);
+    }
+    // every vertex takes 3 codes and every facet 3 codes of at least one byte,
+    // the counts of damaged file are not trusted before the allocation
+    if (header.nVertices > UINT32_MAX ||
+        header.nVertices > vertexStream.size() / 3 ||
+        header.nTriangles > indexStream.size() / 3 ||
+        header.nVertices > 3 * header.nTriangles)
+        return false;
+
+    // restore the vertices from the grid, the delta of damaged file must not take
+    // the coordinate out of the grid (or overflow it)
+    const int64_t maxQ = (int64_t(1) << header.bits) - 1;
+    const double steps = static_cast<double>(maxQ);
+    double step[3];
+    for (int axis = 0; axis < 3; ++axis)
+        step[axis] = (header.boxMax[axis] - header.boxMin[axis]) / steps;
+
+    vertices.resize(header.nVertices);
+    const uchar *vertexPos = vertexStream.data();
+    const uchar *vertexEnd = vertexPos + vertexStream.size();
+    int64_t q[3] = {0, 0, 0};
+    for (common::Vertex &p : vertices)
+    {
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            uint64_t code;
+            if (!readVarint(vertexPos, vertexEnd, code))
+                return false;
+            int64_t delta = unzigzag(code);
+            if (delta < -q[axis] || delta > maxQ - q[axis])
+                return false;
+            q[axis] += delta;
+        }
+        p.x = header.boxMin[0] + q[0] * step[0];
+        p.y = header.boxMin[1] + q[1] * step[1];
+        p.z = header.boxMin[2] + q[2] * step[2];
+    }
+
+    // restore the facets
+    faces.resize(header.nTriangles);
+    const uchar *indexPos = indexStream.data();
+    const uchar *indexEnd = indexPos + indexStream.size();
+    uint64_t nextNew = 0;
+    for (common::Triangle &tri : faces)
+    {
+        for (uint32_t &index : tri.coord)
+        {
+            uint64_t code;
+            if (!readVarint(indexPos, indexEnd, code))
+                return false;
+            if (code == 0)
+            {
+                if (nextNew >= header.nVertices)
+                    return false;
+                index = static_cast<uint32_t>(nextNew++);
+            }
+            else
+            {
+                if (code > nextNew)
+                    return false;
+                index = static_cast<uint32_t>(nextNew - code);
+            }
+        }
+    }
+
+    return nextNew == header.nVertices;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.h"
+#include <QString>
+#include <vector>
+
+class MappedFile;
+struct LoadControl;
+
+// the version of compressed mesh layout
+#define CMESH_VERSION 1
+// the default number of bits per quantized coordinate
+#define CMESH_DEFAULT_BITS 16
+// the range of bits per quantized coordinate
+#define CMESH_MIN_BITS 8
+#define CMESH_MAX_BITS 24
+
+// write the mesh in the compact format: the vertices are quantized to the grid over
+// the bounding box (2^bits - 1 steps per axis), the vertex and index streams are delta
+// coded and compressed by deflate
+bool writeCompressedMesh(const QString &path, const std::vector<common::Vertex> &vertices,
+                         const std::vector<common::Triangle> &faces, int bits = CMESH_DEFAULT_BITS);
+// read the compact format into indexed mesh (no welding needed)
+bool openCompressedMesh(const MappedFile &file, std::vector<common::Vertex> &vertices,
+                        std::vector<common::Triangle> &faces, LoadControl *control = nullptr);
@@ -0,0 +1,65 @@
+#include "modelarena.h"
+#include <algorithm>
+#include <new>
+#include <stdint.h>
+
+ModelArena::~ModelArena()
+{
+    release();
+}
+
+void *ModelArena::do_allocate(size_t bytes, size_t alignment)
+{
+    // take the first block from the current one which has enough space
+    for (; m_block < m_blocks.size(); ++m_block, m_offset = 0)
+    {
+        const Block &block = m_blocks[m_block];
+        uintptr_t base = reinterpret_cast<uintptr_t>(block.data);
+        size_t offset = ((base + m_offset + alignment - 1) & ~(alignment - 1)) - base;
+        if (offset <= block.size && bytes <= block.size - offset)
+        {
+            m_offset = offset + bytes;
+            m_used += bytes;
+            m_highWater = std::max(m_highWater, m_used);
+            ++m_allocations;
+            return block.data + offset;
+        }
+    }
+
+    // the big arrays get the blocks of their own size
+    size_t size = std::max<size_t>(MODEL_ARENA_BLOCK, bytes + alignment);
+    char *data = static_cast<char*>(::operator new(size));
+    m_blocks.push_back({data, size});
+    m_block = m_blocks.size() - 1;
+    m_offset = 0;
+    return do_allocate(bytes, alignment);
+}
+
+void ModelArena::reset()
+{
+    // all blocks are kept: the small operation between two big ones of the same model
+    // must not return the blocks the next big one needs again
+    m_block = 0;
+    m_offset = 0;
+    m_used = 0;
+    m_allocations = 0;
+}
+
+void ModelArena::release()
+{
+    for (const Block &block : m_blocks)
+        ::operator delete(block.data);
+    m_blocks.clear();
+    m_block = 0;
+    m_offset = 0;
+    m_used = 0;
+    m_allocations = 0;
+}
+
+size_t ModelArena::capacity() const
+{
+    size_t size = 0;
+    for (const Block &block : m_blocks)
+        size += block.size;
+    return size;
+}
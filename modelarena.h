@@ -0,0 +1,53 @@
+#pragma once
+
+#include <memory_resource>
+#include <vector>
+#include <stddef.h>
+
+// the minimum size of arena block
+#define MODEL_ARENA_BLOCK (16 << 20)
+
+// the monotonic memory of temporary containers of the model pipeline: the deallocation
+// does nothing and reset() frees everything at once, the blocks are kept for the next
+// operations on the model, so they don't grow and fragment the heap; release() returns
+// the blocks when the model is replaced (not thread-safe)
+class ModelArena : public std::pmr::memory_resource
+{
+    struct Block
+    {
+        char *data;
+        size_t size;
+    };
+
+    std::vector<Block> m_blocks;
+    size_t m_block = 0;         // the current block
+    size_t m_offset = 0;        // the used bytes of current block
+    size_t m_used = 0;          // the bytes allocated since the reset
+    size_t m_highWater = 0;     // the maximum of used bytes
+    size_t m_allocations = 0;   // the number of allocations since the reset
+
+protected:
+    void *do_allocate(size_t bytes, size_t alignment) override;
+    void do_deallocate(void *, size_t, size_t) override {}
+    bool do_is_equal(const std::pmr::memory_resource &other) const noexcept override
+    {
+        return this == &other;
+    }
+
+public:
+    ModelArena() = default;
+    ~ModelArena() override;
+
+    ModelArena(const ModelArena&) = delete;
+    ModelArena &operator=(const ModelArena&) = delete;
+
+    // free all allocations, the blocks are kept
+    void reset();
+    // return all blocks to the heap
+    void release();
+
+    inline size_t used() const {return m_used;}
+    size_t capacity() const;
+    inline size_t highWater() const {return m_highWater;}
+    inline size_t allocations() const {return m_allocations;}
+};
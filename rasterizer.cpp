@@ -0,0 +1,473 @@
+#include "rasterizer.h"
+#include "functions.h"
+#include <algorithm>
+#include <atomic>
+#include <float.h>
+#include <math.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RASTER_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// the vertices are snapped to 1/16 of pixel, so the edge functions are exact in double
+const double subpixels = 16.0;
+// the part of image around the model
+const double rasterMargin = 0.05;
+
+// the vertices in the image: x and y in pixels, z is the depth in the model units
+struct ScreenVertices
+{
+    std::vector<float> x;
+    std::vector<float> y;
+    std::vector<float> z;
+};
+
+// the triangle prepared to draw: the edge functions e = a*x + b*y + c are not negative
+// inside, the depth is z = za + dzdx*(x - xa) + dzdy*(y - ya)
+struct RasterTriangle
+{
+    double a[3];
+    double b[3];
+    double c[3];
+    double xa;
+    double ya;
+    float za;
+    float dzdx;
+    float dzdy;
+    // the pixels with the centers in the bounding box
+    int x0;
+    int y0;
+    int x1;
+    int y1;
+};
+
+// the pixels with the centers in the bounding box of triangle, false if there are none
+inline bool triangleBounds(const ScreenVertices &screen, const common::Triangle &tri,
+                           int width, int height, int &x0, int &y0, int &x1, int &y1)
+{
+    const uint32_t *coord = tri.coord;
+    const float minX = std::min({screen.x[coord[0]], screen.x[coord[1]], screen.x[coord[2]]});
+    const float minY = std::min({screen.y[coord[0]], screen.y[coord[1]], screen.y[coord[2]]});
+    const float maxX = std::max({screen.x[coord[0]], screen.x[coord[1]], screen.x[coord[2]]});
+    const float maxY = std::max({screen.y[coord[0]], screen.y[coord[1]], screen.y[coord[2]]});
+    x0 = std::max(0, static_cast<int>(ceilf(minX - 0.5f)));
+    y0 = std::max(0, static_cast<int>(ceilf(minY - 0.5f)));
+    x1 = std::min(width - 1, static_cast<int>(floorf(maxX - 0.5f)));
+    y1 = std::min(height - 1, static_cast<int>(floorf(maxY - 0.5f)));
+    return x0 <= x1 && y0 <= y1;
+}
+
+// prepare the triangle, return false if it covers no pixel center
+bool setupTriangle(const ScreenVertices &screen, const common::Triangle &tri,
+                   int width, int height, RasterTriangle &raster)
+{
+    if (!triangleBounds(screen, tri, width, height, raster.x0, raster.y0, raster.x1, raster.y1))
+        return false;
+
+    uint32_t i0 = tri.coord[0];
+    uint32_t i1 = tri.coord[1];
+    uint32_t i2 = tri.coord[2];
+    double area = (double(screen.x[i1]) - screen.x[i0]) * (double(screen.y[i2]) - screen.y[i0]) -
+                  (double(screen.y[i1]) - screen.y[i0]) * (double(screen.x[i2]) - screen.x[i0]);
+    if (area == 0.0)
+        return false;
+    // both orientations are drawn, the inside is on the left of edges
+    if (area < 0.0)
+    {
+        std::swap(i1, i2);
+        area = -area;
+    }
+
+    const double x[3] = {screen.x[i0], screen.x[i1], screen.x[i2]};
+    const double y[3] = {screen.y[i0], screen.y[i1], screen.y[i2]};
+
+    for (int k = 0; k < 3; ++k)
+    {
+        const int n = (k + 1) % 3;
+        const double dx = x[n] - x[k];
+        const double dy = y[n] - y[k];
+        raster.a[k] = -dy;
+        raster.b[k] = dx;
+        raster.c[k] = dy * x[k] - dx * y[k];
+    }
+
+    const double z[3] = {screen.z[i0], screen.z[i1], screen.z[i2]};
+    raster.xa = x[0];
+    raster.ya = y[0];
+    raster.za = static_cast<float>(z[0]);
+    raster.dzdx = static_cast<float>(((z[1] - z[0]) * (y[2] - y[0]) - (z[2] - z[0]) * (y[1] - y[0])) / area);
+    raster.dzdy = static_cast<float>(((z[2] - z[0]) * (x[1] - x[0]) - (z[1] - z[0]) * (x[2] - x[0])) / area);
+    return true;
+}
+
+// draw the triangle into the tile buffers, (tileX, tileY) is the first pixel of tile
+void drawTriangle(const RasterTriangle &raster, uint32_t iTri, int tileX, int tileY,
+                  float *depth, uint32_t *ids)
+{
+    const int x0 = std::max(raster.x0, tileX);
+    const int y0 = std::max(raster.y0, tileY);
+    const int x1 = std::min(raster.x1, tileX + RASTER_TILE - 1);
+    const int y1 = std::min(raster.y1, tileY + RASTER_TILE - 1);
+    if (x0 > x1 || y0 > y1)
+        return;
+
+    // the groups of 4 pixels start at the same columns for all triangles, so the
+    // shared edges give the same values of opposite sign and no pixel is missed
+    const int groupX0 = tileX + ((x0 - tileX) & ~3);
+#ifdef RASTER_SSE2
+    const __m128 lanes = _mm_setr_ps(0.0f, 1.0f, 2.0f, 3.0f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 stepA0 = _mm_mul_ps(_mm_set1_ps(static_cast<float>(raster.a[0])), lanes);
+    const __m128 stepA1 = _mm_mul_ps(_mm_set1_ps(static_cast<float>(raster.a[1])), lanes);
+    const __m128 stepA2 = _mm_mul_ps(_mm_set1_ps(static_cast<float>(raster.a[2])), lanes);
+    const __m128 stepZ = _mm_mul_ps(_mm_set1_ps(raster.dzdx), lanes);
+    const __m128 first = _mm_set1_ps(static_cast<float>(x0));
+    const __m128 last = _mm_set1_ps(static_cast<float>(x1));
+    const __m128i id = _mm_set1_epi32(static_cast<int>(iTri));
+#endif
+    for (int py = y0; py <= y1; ++py)
+    {
+        const double qy = py + 0.5;
+        float *depthRow = depth + (py - tileY) * RASTER_TILE;
+        uint32_t *idRow = ids + (py - tileY) * RASTER_TILE;
+        for (int gx = groupX0; gx <= x1; gx += 4)
+        {
+            const int column = gx - tileX;
+            const double qx = gx + 0.5;
+            const double e0 = raster.a[0] * qx + raster.b[0] * qy + raster.c[0];
+            const double e1 = raster.a[1] * qx + raster.b[1] * qy + raster.c[1];
+            const double e2 = raster.a[2] * qx + raster.b[2] * qy + raster.c[2];
+            const float z = raster.za + raster.dzdx * static_cast<float>(qx - raster.xa) +
+                            raster.dzdy * static_cast<float>(qy - raster.ya);
+#ifdef RASTER_SSE2
+            const __m128 x = _mm_add_ps(_mm_set1_ps(static_cast<float>(gx)), lanes);
+            __m128 inside = _mm_and_ps(_mm_cmpge_ps(x, first), _mm_cmple_ps(x, last));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(e0)), stepA0), zero));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(e1)), stepA1), zero));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(_mm_set1_ps(static_cast<float>(e2)), stepA2), zero));
+            if (_mm_movemask_ps(inside) == 0)
+                continue;
+
+            // the depth test and the masked writes of 4 pixels
+            const __m128 zs = _mm_add_ps(_mm_set1_ps(z), stepZ);
+            const __m128 oldDepth = _mm_loadu_ps(depthRow + column);
+            const __m128 closer = _mm_and_ps(inside, _mm_cmplt_ps(zs, oldDepth));
+            if (_mm_movemask_ps(closer) == 0)
+                continue;
+            _mm_storeu_ps(depthRow + column, _mm_or_ps(_mm_and_ps(closer, zs), _mm_andnot_ps(closer, oldDepth)));
+            const __m128i mask = _mm_castps_si128(closer);
+            const __m128i oldId = _mm_loadu_si128(reinterpret_cast<const __m128i*>(idRow + column));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(idRow + column),
+                             _mm_or_si128(_mm_and_si128(mask, id), _mm_andnot_si128(mask, oldId)));
+#else
+            for (int k = 0; k < 4; ++k)
+            {
+                const int px = gx + k;
+                const float lane = static_cast<float>(k);
+                if (px < x0 || px > x1 ||
+                    static_cast<float>(e0) + static_cast<float>(raster.a[0]) * lane < 0.0f ||
+                    static_cast<float>(e1) + static_cast<float>(raster.a[1]) * lane < 0.0f ||
+                    static_cast<float>(e2) + static_cast<float>(raster.a[2]) * lane < 0.0f)
+                    continue;
+                const float zp = z + raster.dzdx * lane;
+                if (zp < depthRow[column + k])
+                {
+                    depthRow[column + k] = zp;
+                    idRow[column + k] = iTri;
+                }
+            }
+#endif
+        }
+    }
+}
+
+template <class V>
+bool rasterize(const std::vector<V> &vertices, const std::vector<common::Triangle> &triangles,
+               const common::Matrix &view, int width, int height,
+               RasterImage &image, bool shade, unsigned threads)
+{
+    image.width = std::max(width, 0);
+    image.height = std::max(height, 0);
+    const size_t nPixels = static_cast<size_t>(image.width) * image.height;
+    image.depth.assign(nPixels, FLT_MAX);
+    image.triangles.assign(nPixels, RASTER_NO_TRIANGLE);
+    image.colors.clear();
+    if (nPixels == 0 || vertices.empty() || triangles.empty())
+        return false;
+
+    // the view coordinates and their bounds in every chunk
+    ScreenVertices screen;
+    screen.x.resize(vertices.size());
+    screen.y.resize(vertices.size());
+    screen.z.resize(vertices.size());
+    const size_t nChunks = std::max<size_t>(1, std::min<size_t>(workerThreads(threads), vertices.size() / 65536));
+    const size_t chunk = (vertices.size() + nChunks - 1) / nChunks;
+    std::vector<common::Vertex> chunkMin(nChunks, common::Vertex( DBL_MAX, DBL_MAX, DBL_MAX));
+    std::vector<common::Vertex> chunkMax(nChunks, common::Vertex(-DBL_MAX,-DBL_MAX,-DBL_MAX));
+    // the precision of float is enough for the image
+    float rot[3][3];
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            rot[i][j] = static_cast<float>(view.coord[i][j]);
+    parallelFor(nChunks, [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; ++c)
+        {
+            float boxMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX};
+            float boxMax[3] = {-FLT_MAX,-FLT_MAX,-FLT_MAX};
+            const size_t last = std::min(vertices.size(), (c + 1) * chunk);
+            for (size_t i = c * chunk; i < last; ++i)
+            {
+                const float p[3] = {static_cast<float>(vertices[i].x),
+                                    static_cast<float>(vertices[i].y),
+                                    static_cast<float>(vertices[i].z)};
+                float q[3];
+                for (int k = 0; k < 3; ++k)
+                {
+                    q[k] = rot[k][0] * p[0] + rot[k][1] * p[1] + rot[k][2] * p[2];
+                    boxMin[k] = std::min(boxMin[k], q[k]);
+                    boxMax[k] = std::max(boxMax[k], q[k]);
+                }
+                screen.x[i] = q[0];
+                screen.y[i] = q[1];
+                screen.z[i] = q[2];
+            }
+            chunkMin[c] = common::Vertex(boxMin[0], boxMin[1], boxMin[2]);
+            chunkMax[c] = common::Vertex(boxMax[0], boxMax[1], boxMax[2]);
+        }
+    }, 1, static_cast<unsigned>(nChunks));
+    common::Vertex boxMin = chunkMin[0];
+    common::Vertex boxMax = chunkMax[0];
+    for (size_t c = 1; c < nChunks; ++c)
+    {
+        boxMin = {std::min(boxMin.x, chunkMin[c].x), std::min(boxMin.y, chunkMin[c].y), std::min(boxMin.z, chunkMin[c].z)};
+        boxMax = {std::max(boxMax.x, chunkMax[c].x), std::max(boxMax.y, chunkMax[c].y), std::max(boxMax.z, chunkMax[c].z)};
+    }
+
+    // fit the model into the image with the margin
+    const double sizeX = std::max(boxMax.x - boxMin.x, DBL_EPSILON);
+    const double sizeY = std::max(boxMax.y - boxMin.y, DBL_EPSILON);
+    image.scale = (1.0 - 2 * rasterMargin) * std::min(image.width / sizeX, image.height / sizeY);
+    image.offsetX = image.width / 2.0 - (boxMin.x + boxMax.x) / 2 * image.scale;
+    image.offsetY = image.height / 2.0 + (boxMin.y + boxMax.y) / 2 * image.scale;
+    const double scale = image.scale;
+    const float scaleF = static_cast<float>(image.scale * subpixels);
+    const float offsetX = static_cast<float>(image.offsetX * subpixels);
+    const float offsetY = static_cast<float>(image.offsetY * subpixels);
+    const float nearest = static_cast<float>(boxMax.z);
+    parallelFor(vertices.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            screen.x[i] = nearbyintf(screen.x[i] * scaleF + offsetX) / static_cast<float>(subpixels);
+            screen.y[i] = nearbyintf(offsetY - screen.y[i] * scaleF) / static_cast<float>(subpixels);
+            screen.z[i] = nearest - screen.z[i];
+        }
+    }, 65536, threads);
+
+    // bin the triangles into the tiles they may cover: the chunks count their
+    // triangles of every tile, then write them after the ones of previous chunks,
+    // so the triangles of tile keep their order and the result is the same for any threads
+    const int tilesX = (image.width + RASTER_TILE - 1) / RASTER_TILE;
+    const int tilesY = (image.height + RASTER_TILE - 1) / RASTER_TILE;
+    const size_t nTiles = static_cast<size_t>(tilesX) * tilesY;
+    const size_t nTriChunks = std::max<size_t>(1, std::min<size_t>(workerThreads(threads), triangles.size() / 65536));
+    const size_t triChunk = (triangles.size() + nTriChunks - 1) / nTriChunks;
+    std::vector<size_t> positions(nTriChunks * nTiles, 0);
+    // the tile of triangle, most of triangles are in one tile and are not bounded again
+    const uint32_t noTile = UINT32_MAX;
+    const uint32_t manyTiles = UINT32_MAX - 1;
+    std::vector<uint32_t> triangleTiles(triangles.size());
+    parallelFor(nTriChunks, [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; ++c)
+        {
+            size_t *counts = &positions[c * nTiles];
+            const size_t last = std::min(triangles.size(), (c + 1) * triChunk);
+            for (size_t t = c * triChunk; t < last; ++t)
+            {
+                int x0, y0, x1, y1;
+                if (!triangleBounds(screen, triangles[t], image.width, image.height, x0, y0, x1, y1))
+                {
+                    triangleTiles[t] = noTile;
+                    continue;
+                }
+                x0 /= RASTER_TILE;
+                y0 /= RASTER_TILE;
+                x1 /= RASTER_TILE;
+                y1 /= RASTER_TILE;
+                triangleTiles[t] = x0 == x1 && y0 == y1 ? static_cast<uint32_t>(y0 * tilesX + x0) : manyTiles;
+                for (int ty = y0; ty <= y1; ++ty)
+                    for (int tx = x0; tx <= x1; ++tx)
+                        ++counts[static_cast<size_t>(ty) * tilesX + tx];
+            }
+        }
+    }, 1, static_cast<unsigned>(nTriChunks));
+
+    std::vector<size_t> tileOffsets(nTiles + 1, 0);
+    size_t sum = 0;
+    for (size_t tile = 0; tile < nTiles; ++tile)
+    {
+        tileOffsets[tile] = sum;
+        for (size_t c = 0; c < nTriChunks; ++c)
+        {
+            size_t n = positions[c * nTiles + tile];
+            positions[c * nTiles + tile] = sum;
+            sum += n;
+        }
+    }
+    tileOffsets[nTiles] = sum;
+    if (sum == 0)
+        return false;
+
+    std::vector<uint32_t> bins(sum);
+    parallelFor(nTriChunks, [&](size_t begin, size_t end)
+    {
+        for (size_t c = begin; c < end; ++c)
+        {
+            size_t *pos = &positions[c * nTiles];
+            const size_t last = std::min(triangles.size(), (c + 1) * triChunk);
+            for (size_t t = c * triChunk; t < last; ++t)
+            {
+                const uint32_t tile = triangleTiles[t];
+                if (tile == noTile)
+                    continue;
+                if (tile != manyTiles)
+                {
+                    bins[pos[tile]++] = static_cast<uint32_t>(t);
+                    continue;
+                }
+                int x0, y0, x1, y1;
+                triangleBounds(screen, triangles[t], image.width, image.height, x0, y0, x1, y1);
+                for (int ty = y0 / RASTER_TILE; ty <= y1 / RASTER_TILE; ++ty)
+                    for (int tx = x0 / RASTER_TILE; tx <= x1 / RASTER_TILE; ++tx)
+                        bins[pos[static_cast<size_t>(ty) * tilesX + tx]++] = static_cast<uint32_t>(t);
+            }
+        }
+    }, 1, static_cast<unsigned>(nTriChunks));
+
+    // the threads take the next tile, the tiles have very different numbers of triangles
+    std::atomic<size_t> nextTile(0);
+    const size_t nThreads = std::min<size_t>(workerThreads(threads), nTiles);
+    parallelFor(nThreads, [&](size_t, size_t)
+    {
+        std::vector<float> depth(RASTER_TILE * RASTER_TILE);
+        std::vector<uint32_t> ids(RASTER_TILE * RASTER_TILE);
+        RasterTriangle raster;
+        for (size_t tile = nextTile++; tile < nTiles; tile = nextTile++)
+        {
+            if (tileOffsets[tile] == tileOffsets[tile + 1])
+                continue;
+
+            const int tileX = static_cast<int>(tile % tilesX) * RASTER_TILE;
+            const int tileY = static_cast<int>(tile / tilesX) * RASTER_TILE;
+            std::fill(depth.begin(), depth.end(), FLT_MAX);
+            std::fill(ids.begin(), ids.end(), RASTER_NO_TRIANGLE);
+            for (size_t i = tileOffsets[tile]; i < tileOffsets[tile + 1]; ++i)
+            {
+                if (setupTriangle(screen, triangles[bins[i]], image.width, image.height, raster))
+                    drawTriangle(raster, bins[i], tileX, tileY, depth.data(), ids.data());
+            }
+
+            // the tile buffers have the full rows, the image may end inside the tile
+            const int rows = std::min(RASTER_TILE, image.height - tileY);
+            const int columns = std::min(RASTER_TILE, image.width - tileX);
+            for (int row = 0; row < rows; ++row)
+            {
+                const size_t pixel = static_cast<size_t>(tileY + row) * image.width + tileX;
+                std::copy_n(&depth[row * RASTER_TILE], columns, &image.depth[pixel]);
+                std::copy_n(&ids[row * RASTER_TILE], columns, &image.triangles[pixel]);
+            }
+        }
+    }, 1, static_cast<unsigned>(nThreads));
+
+    if (!shade)
+        return true;
+
+    // the color of facets in Scene3D, brighter when the triangle faces the viewer
+    image.colors.resize(nPixels);
+    parallelFor(static_cast<size_t>(image.height), [&](size_t begin, size_t end)
+    {
+        for (size_t row = begin; row < end; ++row)
+        {
+            for (size_t i = row * image.width; i < (row + 1) * image.width; ++i)
+            {
+                const uint32_t iTri = image.triangles[i];
+                if (iTri == RASTER_NO_TRIANGLE)
+                {
+                    image.colors[i] = 0xFFFFFFFF;
+                    continue;
+                }
+                const uint32_t *coord = triangles[iTri].coord;
+                common::Vertex p[3];
+                for (int k = 0; k < 3; ++k)
+                    p[k] = common::Vertex(screen.x[coord[k]], screen.y[coord[k]], screen.z[coord[k]] * scale);
+                common::Vector nor;
+                calculateNormal(p[0], p[1], p[2], nor);
+                const double length = nor.length();
+                const double light = 0.35 + 0.65 * (length > 0.0 ? fabs(nor.z) / length : 1.0);
+                const uint32_t r = static_cast<uint32_t>(50 * light);
+                const uint32_t g = static_cast<uint32_t>(170 * light);
+                const uint32_t b = static_cast<uint32_t>(128 * light);
+                image.colors[i] = 0xFF000000 | (r << 16) | (g << 8) | b;
+            }
+        }
+    }, 16, threads);
+    return true;
+}
+
+}
+
+bool rasterizeMesh(const std::vector<common::VertexF> &vertices,
+                   const std::vector<common::Triangle> &triangles,
+                   const common::Matrix &view, int width, int height,
+                   RasterImage &image, bool shade, unsigned threads)
+{
+    // input variables:
+    // view - the rows are the directions to the right, up and to the viewer
+    // width, height - the size of image in pixels
+    // shade - fill the colors of image too
+    // threads - the number of threads (0 - the number of cores)
+
+    return rasterize(vertices, triangles, view, width, height, image, shade, threads);
+}
+
+bool rasterizeMesh(const std::vector<common::Vertex> &vertices,
+                   const std::vector<common::Triangle> &triangles,
+                   const common::Matrix &view, int width, int height,
+                   RasterImage &image, bool shade, unsigned threads)
+{
+    return rasterize(vertices, triangles, view, width, height, image, shade, threads);
+}
+
+common::Matrix rasterView(const common::Vector &angles)
+{
+    // the same rotations as glRotated() calls of Scene3D::paintGL
+    common::Matrix view;
+    for (int i = 0; i < 3; ++i)
+        view.coord[i][i] = 1.0;
+    const double rad[3] = {angles.x / 180.0 * M_PI, angles.y / 180.0 * M_PI, angles.z / 180.0 * M_PI};
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        // the rotation around the axis, the next axes are rotated first
+        const int i = (axis + 1) % 3;
+        const int j = (axis + 2) % 3;
+        common::Matrix rot;
+        rot.coord[axis][axis] = 1.0;
+        rot.coord[i][i] = cos(rad[axis]);
+        rot.coord[i][j] =-sin(rad[axis]);
+        rot.coord[j][i] = sin(rad[axis]);
+        rot.coord[j][j] = cos(rad[axis]);
+
+        common::Matrix res;
+        for (int r = 0; r < 3; ++r)
+            for (int c = 0; c < 3; ++c)
+                for (int k = 0; k < 3; ++k)
+                    res.coord[r][c] += view.coord[r][k] * rot.coord[k][c];
+        view = res;
+    }
+    return view;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "common.h"
+#include <vector>
+#include <stdint.h>
+
+// the pixel without triangle in RasterImage::triangles
+#define RASTER_NO_TRIANGLE UINT32_MAX
+// the size of square tile in pixels, the tiles are drawn in parallel
+#define RASTER_TILE 64
+
+// the images of model drawn on CPU by the orthographic projection, pixel (i, j) is
+// item j*width + i (row j from the top), the model point p is drawn at
+// i = (p * view).x * scale + offsetX, j = offsetY - (p * view).y * scale
+struct RasterImage
+{
+    int width = 0;
+    int height = 0;
+    double scale = 1.0;
+    double offsetX = 0.0;
+    double offsetY = 0.0;
+    // the distance from the nearest point of model along the view direction, FLT_MAX if no triangle
+    std::vector<float> depth;
+    // the visible triangle of pixel or RASTER_NO_TRIANGLE
+    std::vector<uint32_t> triangles;
+    // 0xAARRGGBB shaded by the angle between the triangle and the view (if asked)
+    std::vector<uint32_t> colors;
+};
+
+// draw the triangles fitted into the image, the rows of 'view' are the directions
+// to the right, up and to the viewer in the model coordinates, return false if nothing is drawn
+bool rasterizeMesh(const std::vector<common::VertexF> &vertices,
+                   const std::vector<common::Triangle> &triangles,
+                   const common::Matrix &view, int width, int height,
+                   RasterImage &image, bool shade = false, unsigned threads = 0);
+bool rasterizeMesh(const std::vector<common::Vertex> &vertices,
+                   const std::vector<common::Triangle> &triangles,
+                   const common::Matrix &view, int width, int height,
+                   RasterImage &image, bool shade = false, unsigned threads = 0);
+// the view by the rotation angles (degrees) of Scene3D: around X, then Y, then Z
+common::Matrix rasterView(const common::Vector &angles);
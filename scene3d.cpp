@@ -3,24 +3,164 @@
 #include <QDebug>
 #include <QMouseEvent>
 #include <QApplication>
-#include <unordered_map>
+#include <QScreen>
 #include <fstream>
 #include <float.h>
 #include <math.h>
 
+namespace {
+
+common::Matrix multiply(const common::Matrix &a, const common::Matrix &b)
+{
+    common::Matrix res;
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            for (int k = 0; k < 3; ++k)
+                res.coord[i][j] += a.coord[i][k] * b.coord[k][j];
+    return res;
+}
+
+// the rotation of model by the build direction (in degrees): around X, then Y, then Z
+common::Matrix buildRotation(const common::Vector &direction)
+{
+    common::Matrix rotX;
+    {
+        double cos_x = cos(direction.x / 180.0 * M_PI);
+        double sin_x = sin(direction.x / 180.0 * M_PI);
+        rotX.coord[0][0] = 1.0;
+        rotX.coord[1][1] = cos_x;
+        rotX.coord[1][2] =-sin_x;
+        rotX.coord[2][1] = sin_x;
+        rotX.coord[2][2] = cos_x;
+    }
+
+    common::Matrix rotY;
+    {
+        double cos_y = cos(direction.y / 180.0 * M_PI);
+        double sin_y = sin(direction.y / 180.0 * M_PI);
+        rotY.coord[0][0] = cos_y;
+        rotY.coord[0][2] = sin_y;
+        rotY.coord[1][1] = 1.0;
+        rotY.coord[2][0] =-sin_y;
+        rotY.coord[2][2] = cos_y;
+    }
+
+    common::Matrix rotZ;
+    {
+        double cos_z = cos(direction.z / 180.0 * M_PI);
+        double sin_z = sin(direction.z / 180.0 * M_PI);
+        rotZ.coord[0][0] = cos_z;
+        rotZ.coord[0][1] =-sin_z;
+        rotZ.coord[1][0] = sin_z;
+        rotZ.coord[1][1] = cos_z;
+        rotZ.coord[2][2] = 1.0;
+    }
+
+    // the vertex multiplied by the matrix is rotX * vertex
+    return multiply(rotZ, multiply(rotY, rotX));
+}
+
+// the step of 1, 2 or 5 by the power of 10 not less than 'value'
+double roundStepUp(double value)
+{
+    const double power = pow(10.0, floor(log10(value)));
+    for (double factor : {1.0, 2.0, 5.0})
+        if (factor * power >= value * (1.0 - 1e-9))
+            return factor * power;
+    return 10.0 * power;
+}
+
+// multiply the current matrix of OpenGL by the rotation
+void multMatrix(const common::Matrix &rot)
+{
+    // the matrix of OpenGL is stored by columns
+    GLdouble transform[16] = {};
+    for (int i = 0; i < 3; ++i)
+        for (int j = 0; j < 3; ++j)
+            transform[4*j + i] = rot.coord[i][j];
+    transform[15] = 1.0;
+    glMultMatrixd(transform);
+}
+
+}
+
 // Initiation of Scene3D object
-Scene3D::Scene3D(QWidget* parent) : QGLWidget(parent)
+Scene3D::Scene3D(QWidget* parent) : QOpenGLWidget(parent)
 {
     m_scaleDefault = 1.0;
     m_totalArea = 0.0;
+    m_showMask = 0;
+    m_releaseHidden = false;
+    m_isPreview = false;
+    m_firstFacet = 0;
+    m_deferRotation = true;
+    m_frustumCulling = true;
+    m_backFaceCulling = false;
+    m_multiDrawArrays = nullptr;
+    m_multiDrawElements = nullptr;
+    m_viewWidth = 1.0;
+    m_viewHeight = 1.0;
+    m_uploadedLevel = SIZE_MAX;
+    m_interacting = false;
+    m_rotationPending = false;
+    m_groundCoarse = 0;
+    m_groundStep = 0.0;
+    m_groundCenterX = 0.0;
+    m_groundCenterY = 0.0;
     defaultScene();
+    m_drawnView = viewState();
+
+    // draw the full model when the view stays still
+    m_idleTimer.setSingleShot(true);
+    m_idleTimer.setInterval(LOD_IDLE_DELAY);
+    connect(&m_idleTimer, &QTimer::timeout, this, [this]()
+    {
+        bool levelDrawn = interactiveLevel() != nullptr;
+        m_interacting = false;
+        if (levelDrawn)
+            update();
+    });
+    // the frames asked by input are drawn by the timer
+    m_frameTimer.setSingleShot(true);
+    m_frameTimer.setTimerType(Qt::PreciseTimer);
+    connect(&m_frameTimer, &QTimer::timeout, this, &Scene3D::drawRequestedFrame);
+    connect(this, &QOpenGLWidget::frameSwapped, this, &Scene3D::frameSwapped);
+}
+
+Scene3D::~Scene3D()
+{
+    // the buffers are deleted while the context is alive
+    if (context() != nullptr)
+    {
+        disconnect(context(), nullptr, this, nullptr);
+        destroyBuffers();
+    }
+}
+
+void Scene3D::destroyBuffers()
+{
+    makeCurrent();
+    m_vertexBuffer.destroy(this);
+    m_edgeBuffer.destroy(this);
+    m_triangleBuffer.destroy(this);
+    m_drawVertexBuffer.destroy(this);
+    m_drawColorBuffer.destroy(this);
+    m_normalBuffer.destroy(this);
+    m_groundBuffer.destroy(this);
+    m_levelVertexBuffer.destroy(this);
+    m_levelTriangleBuffer.destroy(this);
+    doneCurrent();
 }
 
 // Initiation of OpenGL
 void Scene3D::initializeGL()
 {
+    initializeOpenGLFunctions();
+    // the context is recreated when the widget changes its window,
+    // the buffers are uploaded again into the new one
+    connect(context(), &QOpenGLContext::aboutToBeDestroyed, this, &Scene3D::destroyBuffers);
     // set the background color
-    qglClearColor(Qt::white);
+    glClearColor(1.0f, 1.0f, 1.0f, 1.0f);
     // to hide the covered deeper objects
     glEnable(GL_DEPTH_TEST);
     // disable the shade
@@ -31,32 +171,56 @@ void Scene3D::initializeGL()
     glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
     // to use the arrays of vertices for drawing
     glEnableClientState(GL_VERTEX_ARRAY);
-    // to use to draw triangles
-    glEnableClientState(GL_INDEX_ARRAY);
+    // the visible clusters are drawn by one call if the driver has OpenGL 1.4
+    m_multiDrawArrays = reinterpret_cast<PFNGLMULTIDRAWARRAYSPROC>(
+                context()->getProcAddress("glMultiDrawArrays"));
+    m_multiDrawElements = reinterpret_cast<PFNGLMULTIDRAWELEMENTSPROC>(
+                context()->getProcAddress("glMultiDrawElements"));
 }
 
 // Recalculate the scene parameters after the window will resized
 void Scene3D::resizeGL(int nWidth, int nHeight)
+{
+    // transform to window coordinates, the projection is set by paintGL
+    glViewport(0, 0, nWidth, nHeight);
+}
+
+// Set the projection by the current size (the widget drawn offscreen gets no resize events)
+void Scene3D::setProjection()
 {
     glMatrixMode(GL_PROJECTION);
     glLoadIdentity();
     // choose the most problem direction
+    const int nWidth = std::max(width(), 1);
+    const int nHeight = std::max(height(), 1);
     GLdouble ratio = static_cast<GLdouble>(nHeight)/nWidth;
     if (nWidth >= nHeight)
+    {
         // change the matrix using horizontal ratio
-        glOrtho(-1.0 / ratio, 1.0 / ratio, -1.0, 1.0, -10.0, 1.0);
+        m_viewWidth = 1.0 / ratio;
+        m_viewHeight = 1.0;
+    }
     else
+    {
         // change the matrix using vertical ratio
-        glOrtho(-1.0, 1.0, -1.0*ratio, 1.0*ratio, -10.0, 1.0);
-    // transform to window coordinates
-    glViewport(0, 0, nWidth, nHeight);
+        m_viewWidth = 1.0;
+        m_viewHeight = 1.0*ratio;
+    }
+    glOrtho(-m_viewWidth, m_viewWidth, -m_viewHeight, m_viewHeight, -10.0, 1.0);
 }
 
 // Draw the scene
 void Scene3D::paintGL()
 {
+    m_frameClock.start();
+    m_drawnView = viewState();
+    // the input drawn by this frame, the next input waits for the next frame
+    m_drawnInputClock = m_inputClock;
+    m_inputClock.invalidate();
+
     // set the initial parameters
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    setProjection();
     glMatrixMode(GL_MODELVIEW);
     // reset the transformation matrix to identity
     glLoadIdentity();
@@ -72,10 +236,58 @@ void Scene3D::paintGL()
 
     // draw the elements using the 'elements visibility' variable
     drawAxis();
-    drawWireframe();
-    drawTriangles();
-    drawNormals();
+    glPushMatrix();
+    const common::MeshLevel *level = interactiveLevel();
+    if (level != nullptr)
+    {
+        // the level is rotated from the original coordinates
+        multMatrix(buildRotation(m_buildDirection));
+        drawLevel(*level);
+    }
+    else
+    {
+        if (m_bakedDirection != m_buildDirection)
+        {
+            // the model is rotated from the baked direction to the current one
+            common::Matrix baked = buildRotation(m_bakedDirection);
+            common::Matrix inverse;
+            for (int i = 0; i < 3; ++i)
+                for (int j = 0; j < 3; ++j)
+                    inverse.coord[i][j] = baked.coord[j][i];
+            multMatrix(multiply(buildRotation(m_buildDirection), inverse));
+        }
+        cullClusters();
+        drawWireframe();
+        drawTriangles();
+        drawNormals();
+    }
+    glPopMatrix();
     drawGround();
+
+    // the hidden elements give their memory on GPU back too
+    if (isReleased(shTriangles))
+    {
+        m_drawVertexBuffer.destroy(this);
+        m_drawColorBuffer.destroy(this);
+    }
+    if (isReleased(shNormals))
+        m_normalBuffer.destroy(this);
+    if (isReleased(shGround))
+        m_groundBuffer.destroy(this);
+    if (m_levels.empty())
+    {
+        m_levelVertexBuffer.destroy(this);
+        m_levelTriangleBuffer.destroy(this);
+    }
+
+    if (m_drawnInputClock.isValid())
+    {
+        const double frameMs = m_frameClock.nsecsElapsed() / 1e6;
+        ++m_frameStats.frames;
+        m_frameStats.lastFrameMs = frameMs;
+        m_frameStats.maxFrameMs = std::max(m_frameStats.maxFrameMs, frameMs);
+        m_frameStats.totalFrameMs += frameMs;
+    }
 }
 
 // Set the initial position of actions doing by mouse
@@ -93,14 +305,14 @@ void Scene3D::mouseReleaseEvent(QMouseEvent* /*pe*/)
 // Process rotation by mouse
 void Scene3D::mouseMoveEvent(QMouseEvent* pe)
 {
-    if (QApplication::keyboardModifiers().testFlag(Qt::ShiftModifier) == true)
+    // the preview can be viewed only, the loading thread builds the model meanwhile
+    if (QApplication::keyboardModifiers().testFlag(Qt::ShiftModifier) == true && !m_isPreview)
     {
         // calculate rotation by X axis
         m_buildDirection.x += 180.0 * static_cast<GLdouble>(pe->y() - ptrMousePosition.y()) / height();
         // calculate rotation by Z axis
         m_buildDirection.z += 180.0 * static_cast<GLdouble>(pe->x() - ptrMousePosition.x()) / width();
-        applyModelRotation();
-        updateForDraw();
+        rotateModel();
     }
     else
     {
@@ -113,7 +325,7 @@ void Scene3D::mouseMoveEvent(QMouseEvent* pe)
     // save the mouse position
     ptrMousePosition = pe->pos();
     // draw the scene
-    updateGL();
+    requestFrame();
 }
 
 // Process zoom by mouse
@@ -126,70 +338,271 @@ void Scene3D::wheelEvent(QWheelEvent* pe)
         scaleDown();
 
     // draw the scene
-    updateGL();
+    requestFrame();
 }
 
 void Scene3D::updateForDraw()
 {
-    const uint8_t A = 255;
+    if (isReleased(shTriangles))
+    {
+        std::vector<common::VertexF>().swap(m_drawVertices);
+        std::vector<Color>().swap(m_drawColor);
+        m_drawVertexBuffer.invalidate();
+        m_drawColorBuffer.invalidate();
+        return;
+    }
 
-    m_drawColor.clear();
-    m_drawVertices.clear();
-    m_drawTriangles.clear();
+    updateDrawPositions();
+    updateDrawColors();
+}
+
+// the geometry is changed, the colors stay as they are
+void Scene3D::updateDrawPositions()
+{
+    if (isReleased(shTriangles))
+        return;
 
-    auto addTriangle = [&](uint32_t iTri, uint8_t R, uint8_t G, uint8_t B)
+    m_drawVertices.resize(3 * m_triangles.size());
+    m_drawVertexBuffer.invalidate();
+    parallelFor(m_triangles.size(), [this](size_t begin, size_t end)
     {
-        uint32_t index = static_cast<uint32_t>(m_drawVertices.size());
-        m_drawTriangles.push_back({index, index + 1, index + 2});
+        for (size_t i = begin; i < end; ++i)
+        {
+            const common::Triangle &tri = m_triangles[i];
+            m_drawVertices[3*i    ] = m_vertices[tri.coord[0]];
+            m_drawVertices[3*i + 1] = m_vertices[tri.coord[1]];
+            m_drawVertices[3*i + 2] = m_vertices[tri.coord[2]];
+        }
+    }, 65536);
+}
+
+Scene3D::Color Scene3D::triangleColor(uint32_t iTri) const
+{
+    if (iTri / 64 < m_supportMask.size() && (m_supportMask[iTri / 64] >> (iTri % 64) & 1))
+        return {255, 0, 0, 255};
+    if (!m_faces.empty())
+        return m_faceColors[m_triangleFaces[iTri]];
+    return {50, 170, 128, 255};
+}
+
+// the colors of all triangles are changed, the geometry stays as it is
+void Scene3D::updateDrawColors()
+{
+    if (isReleased(shTriangles))
+        return;
 
-        auto addTriangle1 = [&](uint8_t r, uint8_t g, uint8_t b)
+    m_drawColor.resize(3 * m_triangles.size());
+    m_drawColorBuffer.invalidate();
+    parallelFor(m_triangles.size(), [this](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
         {
-            const common::Triangle &tri = m_triangles[iTri];
-            for (uint8_t i = 0; i < 3; ++i)
-            {
-                m_drawVertices.push_back(m_vertices[tri.coord[i]]);
-                m_drawColor.push_back(r);
-                m_drawColor.push_back(g);
-                m_drawColor.push_back(b);
-                m_drawColor.push_back(A);
-            }
-        };
+            Color color = triangleColor(static_cast<uint32_t>(i));
+            m_drawColor[3*i] = m_drawColor[3*i + 1] = m_drawColor[3*i + 2] = color;
+        }
+    }, 65536);
+}
 
-        if (m_isTriangleSupported[iTri])
-            addTriangle1(255, 0, 0);
-        else
-            addTriangle1(R, G, B);
+// only the colors of given triangles are changed
+void Scene3D::updateDrawColors(const std::pmr::vector<uint32_t> &triangles)
+{
+    if (m_drawColor.size() != 3 * m_triangles.size())
+    {
+        updateDrawColors();
+        return;
+    }
+
+    for (uint32_t i : triangles)
+    {
+        Color color = triangleColor(i);
+        m_drawColor[3*i] = m_drawColor[3*i + 1] = m_drawColor[3*i + 2] = color;
+        m_drawColorBuffer.invalidate(m_drawColor, 3*i, 3);
+    }
+}
+
+void Scene3D::updateVisibility()
+{
+    if (!m_releaseHidden || m_triangles.empty())
+        return;
+
+    // the released buffers are built again when their elements are shown,
+    // the buffers of hidden elements are released by the update functions
+    // (shown but empty or hidden but kept)
+    auto needsUpdate = [this](int mask, bool empty)
+    {
+        return ((m_showMask & mask) != 0) == empty;
     };
+    if (needsUpdate(shTriangles, m_drawVertices.empty()))
+        updateForDraw();
+    if (needsUpdate(shNormals, m_normalVertices.empty()))
+        updateNormalVertices();
+    if (needsUpdate(shGround, m_groundVertices.empty()))
+        updateGround();
+}
+
+void Scene3D::setLevels(std::vector<common::MeshLevel> &&levels)
+{
+    std::swap(m_levels, levels);
+    m_uploadedLevel = SIZE_MAX;
+}
+
+void Scene3D::interact()
+{
+    m_interacting = true;
+    m_idleTimer.start();
+}
+
+bool Scene3D::ViewState::operator == (const ViewState &other) const
+{
+    return rotate == other.rotate && buildDirection == other.buildDirection &&
+           translX == other.translX && translZ == other.translZ && scale == other.scale;
+}
 
-    m_drawColor.reserve(12 * m_triangles.size());
-    m_drawVertices.reserve(3 * m_triangles.size());
-    m_drawTriangles.reserve(m_triangles.size() - m_supportedTriangles.size());
+Scene3D::ViewState Scene3D::viewState() const
+{
+    return {m_rotate, m_buildDirection, m_translX, m_translZ, m_scale};
+}
+
+void Scene3D::requestFrame()
+{
+    ++m_frameStats.inputEvents;
+    if (!m_inputClock.isValid())
+        m_inputClock.start();
+    // the frame is asked already, it draws the changes of this event too
+    if (m_frameTimer.isActive())
+        return;
+
+    // the display shows no more than one frame per refresh
+    const QScreen *screen = QGuiApplication::primaryScreen();
+    const qreal rate = screen != nullptr ? screen->refreshRate() : 0.0;
+    const qint64 interval = rate > 1.0 ? static_cast<qint64>(1000.0 / rate) : FRAME_DEFAULT_INTERVAL;
+    const qint64 elapsed = m_frameClock.isValid() ? m_frameClock.elapsed() : interval;
+    m_frameTimer.start(static_cast<int>(std::max<qint64>(interval - elapsed, 0)));
+}
 
-    if (m_faces.empty())
+void Scene3D::drawRequestedFrame()
+{
+    // the build rotation of all events is applied once
+    if (m_rotationPending)
     {
-        uint8_t R = 50;
-        uint8_t G = 170;
-        uint8_t B = 128;
+        m_rotationPending = false;
+        applyModelRotation();
+        updateDrawPositions();
+    }
+    if (viewState() == m_drawnView)
+    {
+        ++m_frameStats.skippedFrames;
+        m_inputClock.invalidate();
+        return;
+    }
+    interact();
+    update();
+}
 
-        for (uint32_t i = 0 ; i < m_triangles.size(); ++i)
-        {
-            addTriangle(i, R, G, B);
-        }
+void Scene3D::frameSwapped()
+{
+    if (!m_drawnInputClock.isValid())
+        return;
+
+    const double latencyMs = m_drawnInputClock.nsecsElapsed() / 1e6;
+    m_drawnInputClock.invalidate();
+    m_frameStats.lastLatencyMs = latencyMs;
+    m_frameStats.maxLatencyMs = std::max(m_frameStats.maxLatencyMs, latencyMs);
+    m_frameStats.totalLatencyMs += latencyMs;
+}
+
+const common::MeshLevel *Scene3D::interactiveLevel() const
+{
+    if (!m_interacting || m_levels.empty() || m_triangles.size() <= LOD_INTERACTIVE_TRIANGLES)
+        return nullptr;
+
+    // the finest level which is fast enough to draw, or the coarsest one
+    for (const common::MeshLevel &level : m_levels)
+        if (level.triangles.size() <= LOD_INTERACTIVE_TRIANGLES)
+            return &level;
+    return &m_levels.back();
+}
+
+void Scene3D::setReleaseHidden(bool release)
+{
+    m_releaseHidden = release;
+    if (release)
+    {
+        updateVisibility();
     }
-    else
+    else if (!m_triangles.empty())
     {
-        for (const auto &faceTriangles : m_faces)
-        {
-            auto R = static_cast<uint8_t>(std::rand()*256/RAND_MAX);
-            auto G = static_cast<uint8_t>(std::rand()*256/RAND_MAX);
-            auto B = static_cast<uint8_t>(std::rand()*256/RAND_MAX);
+        // all buffers are kept again
+        if (m_drawVertices.empty())
+            updateForDraw();
+        if (m_normalVertices.empty())
+            updateNormalVertices();
+        if (m_groundVertices.empty())
+            updateGround();
+    }
+}
 
-            for (uint32_t i : faceTriangles)
-            {
-                addTriangle(i, R, G, B);
-            }
-        }
+namespace {
+
+template <class T>
+void addBuffer(std::vector<Scene3D::BufferMemory> &report, const char *name,
+               const std::vector<T> &buffer)
+{
+    report.push_back({name, buffer.size() * sizeof(T), buffer.capacity() * sizeof(T)});
+}
+
+}
+
+void Scene3D::memoryReport(std::vector<BufferMemory> &report) const
+{
+    report.clear();
+    addBuffer(report, "verticesOrig", m_verticesOrig);
+    addBuffer(report, "vertices", m_vertices);
+    addBuffer(report, "triangles", m_triangles);
+    addBuffer(report, "normals", m_normals);
+    addBuffer(report, "triangleArea", m_triangleArea);
+    addBuffer(report, "normalVertices", m_normalVertices);
+    addBuffer(report, "edges", m_edges);
+    addBuffer(report, "triangleEdges", m_triangleEdges);
+    addBuffer(report, "edgeTriangles.offsets", m_edgeTriangles.offsets);
+    addBuffer(report, "edgeTriangles.indices", m_edgeTriangles.indices);
+    addBuffer(report, "vertexTriangles.offsets", m_vertexTriangles.offsets);
+    addBuffer(report, "vertexTriangles.indices", m_vertexTriangles.indices);
+    addBuffer(report, "triangleFaces", m_triangleFaces);
+    addBuffer(report, "faces.offsets", m_faces.offsets);
+    addBuffer(report, "faces.indices", m_faces.indices);
+    addBuffer(report, "mergeTree", m_mergeTree.merges);
+    addBuffer(report, "supportMask", m_supportMask);
+    addBuffer(report, "degenerateMask", m_degenerateMask);
+    addBuffer(report, "normalZ", m_normalZ);
+    addBuffer(report, "triangleTopZ", m_triangleTopZ);
+    addBuffer(report, "groundVertices", m_groundVertices);
+    addBuffer(report, "drawVertices", m_drawVertices);
+    addBuffer(report, "drawColor", m_drawColor);
+    addBuffer(report, "faceColors", m_faceColors);
+    addBuffer(report, "clusters", m_clusters);
+    addBuffer(report, "clusterEdges", m_clusterEdges);
+    size_t levelVertices = 0;
+    size_t levelTriangles = 0;
+    for (const common::MeshLevel &level : m_levels)
+    {
+        levelVertices += level.vertices.capacity() * sizeof(common::VertexF);
+        levelTriangles += level.triangles.capacity() * sizeof(common::Triangle);
     }
+    report.push_back({"levels.vertices", levelVertices, levelVertices});
+    report.push_back({"levels.triangles", levelTriangles, levelTriangles});
+    // the temporaries are reported by their maximum
+    report.push_back({"arena (high water)", m_arena.highWater(), m_arena.capacity()});
+    // the copies on GPU
+    report.push_back({"gpu.vertices", m_vertexBuffer.size(), m_vertexBuffer.size()});
+    report.push_back({"gpu.edges", m_edgeBuffer.size(), m_edgeBuffer.size()});
+    report.push_back({"gpu.triangles", m_triangleBuffer.size(), m_triangleBuffer.size()});
+    report.push_back({"gpu.drawVertices", m_drawVertexBuffer.size(), m_drawVertexBuffer.size()});
+    report.push_back({"gpu.drawColor", m_drawColorBuffer.size(), m_drawColorBuffer.size()});
+    report.push_back({"gpu.normalVertices", m_normalBuffer.size(), m_normalBuffer.size()});
+    report.push_back({"gpu.groundVertices", m_groundBuffer.size(), m_groundBuffer.size()});
+    report.push_back({"gpu.levelVertices", m_levelVertexBuffer.size(), m_levelVertexBuffer.size()});
+    report.push_back({"gpu.levelTriangles", m_levelTriangleBuffer.size(), m_levelTriangleBuffer.size()});
 }
 
 void Scene3D::setGroundHeight(double value)
@@ -197,12 +610,23 @@ void Scene3D::setGroundHeight(double value)
     m_groundHeight = value;
 }
 
-bool Scene3D::vertexOnTheGround(size_t iVert)
+void Scene3D::updateOverhangData()
 {
-    if (iVert < m_vertices.size())
-        if (m_vertices[iVert].z - m_boundBoxMin.z < m_groundHeight)
-            return true;
-    return false;
+    if (m_normalZ.size() == m_triangles.size() && m_triangleTopZ.size() == m_triangles.size())
+        return;
+
+    m_normalZ.resize(m_triangles.size());
+    m_triangleTopZ.resize(m_triangles.size());
+    parallelFor(m_triangles.size(), [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i)
+        {
+            const uint32_t *tri = m_triangles[i].coord;
+            m_normalZ[i] = isDegenerate(static_cast<uint32_t>(i)) ? 0.0f :
+                           static_cast<float>(m_normals[i].unpack().z);
+            m_triangleTopZ[i] = std::max({m_vertices[tri[0]].z, m_vertices[tri[1]].z, m_vertices[tri[2]].z});
+        }
+    }, 65536);
 }
 
 void Scene3D::scaleUp()
@@ -275,6 +699,7 @@ void Scene3D::translateRight()
 void Scene3D::defaultScene()
 {
     m_buildDirection = {0.0, 0.0, 0.0};
+    m_bakedDirection = {0.0, 0.0, 0.0};
     m_rotate = {-90.0, 0.0, 0.0};
     m_translX = 0;
     m_translZ = 0;
@@ -288,87 +713,96 @@ void Scene3D::defaultScene()
 void Scene3D::rotateModelUpX()
 {
     m_buildDirection.x += 1.0;
-    applyModelRotation();
-    updateForDraw();
+    rotateModel();
 }
 
 void Scene3D::rotateModelDownX()
 {
     m_buildDirection.x -= 1.0;
-    applyModelRotation();
-    updateForDraw();
+    rotateModel();
 }
 
 void Scene3D::rotateModelUpY()
 {
     m_buildDirection.y += 1.0;
-    applyModelRotation();
-    updateForDraw();
+    rotateModel();
 }
 
 void Scene3D::rotateModelDownY()
 {
     m_buildDirection.y -= 1.0;
-    applyModelRotation();
-    updateForDraw();
+    rotateModel();
 }
 
 void Scene3D::rotateModelUpZ()
 {
     m_buildDirection.z += 1.0;
-    applyModelRotation();
-    updateForDraw();
+    rotateModel();
 }
 
 void Scene3D::rotateModelDownZ()
 {
     m_buildDirection.z -= 1.0;
-    applyModelRotation();
-    updateForDraw();
+    rotateModel();
+}
+
+void Scene3D::rotateModel()
+{
+    m_needsUpdate = true;
+    // the rotation is drawn by the render transform until it's baked
+    if (m_deferRotation)
+        return;
+
+    // the rotation is applied by the next frame for all events before it
+    m_rotationPending = true;
 }
 
 void Scene3D::applyModelRotation()
 {
     m_needsUpdate = true;
+    m_rotationPending = false;
+    m_bakedDirection = m_buildDirection;
 
-    common::Matrix rotX;
+    const common::Matrix rot = buildRotation(m_buildDirection);
+    parallelFor(m_vertices.size(), [&](size_t begin, size_t end)
     {
-        double cos_x = cos(m_buildDirection.x / 180.0 * M_PI);
-        double sin_x = sin(m_buildDirection.x / 180.0 * M_PI);
-        rotX.coord[0][0] = 1.0;
-        rotX.coord[1][1] = cos_x;
-        rotX.coord[1][2] =-sin_x;
-        rotX.coord[2][1] = sin_x;
-        rotX.coord[2][2] = cos_x;
-    }
+        for (size_t i = begin; i < end; ++i)
+        {
+            const common::Vertex vertexOrig = m_verticesOrig[i];
+            m_vertices[i] = common::VertexF(vertexOrig * rot);
+        }
+    }, 65536);
+    m_vertexBuffer.invalidate();
+    // the overhang data is built again from the same state of vertices and normals,
+    // the normals are baked by fitModel() after the rotation
+    m_normalZ.clear();
+    m_triangleTopZ.clear();
+    // the clusters are built again for the new vertices by updateAll()
+    m_clusters.clear();
+    m_clusterEdges.clear();
+}
 
-    common::Matrix rotY;
-    {
-        double cos_y = cos(m_buildDirection.y / 180.0 * M_PI);
-        double sin_y = sin(m_buildDirection.y / 180.0 * M_PI);
-        rotY.coord[0][0] = cos_y;
-        rotY.coord[0][2] = sin_y;
-        rotY.coord[1][1] = 1.0;
-        rotY.coord[2][0] =-sin_y;
-        rotY.coord[2][2] = cos_y;
-    }
+void Scene3D::setFrustumCulling(bool cull)
+{
+    m_frustumCulling = cull;
+    update();
+}
 
-    common::Matrix rotZ;
-    {
-        double cos_z = cos(m_buildDirection.z / 180.0 * M_PI);
-        double sin_z = sin(m_buildDirection.z / 180.0 * M_PI);
-        rotZ.coord[0][0] = cos_z;
-        rotZ.coord[0][1] =-sin_z;
-        rotZ.coord[1][0] = sin_z;
-        rotZ.coord[1][1] = cos_z;
-        rotZ.coord[2][2] = 1.0;
-    }
+void Scene3D::setBackFaceCulling(bool cull)
+{
+    m_backFaceCulling = cull;
+    update();
+}
 
-    for (size_t i = 0; i < m_vertices.size(); ++i)
+void Scene3D::setDeferRotation(bool defer)
+{
+    m_deferRotation = defer;
+    // bake the rotation drawn by the transform
+    if (!defer && m_bakedDirection != m_buildDirection)
     {
-        const auto &vertexOrig = m_verticesOrig[i];
-        auto &vertex = m_vertices[i];
-        vertex = vertexOrig * rotX * rotY * rotZ;
+        applyModelRotation();
+        updateDrawPositions();
+        update();
     }
 }
 
@@ -405,31 +839,218 @@ void Scene3D::drawAxis()
 bool Scene3D::setModel(std::vector<common::Vertex> &&vertices,
                        std::vector<common::Triangle> &&faces)
 {
-    std::swap(m_vertices, vertices);
+    m_isPreview = false;
+    m_firstFacet = 0;
+    // the temporaries of previous model are returned to the heap, the new one can need
+    // much less of them
+    m_arena.release();
     std::swap(m_triangles, faces);
+    // the levels of previous model are built again
+    m_levels.clear();
+    m_clusters.clear();
+    m_clusterEdges.clear();
+    m_vertexBuffer.invalidate();
+    m_triangleBuffer.invalidate();
+    m_edgeBuffer.invalidate();
     defaultScene();
-    return fitModel(true);
+
+    // fit vertices coordinates to the center point, the precision of float
+    // is enough for the coordinates relative to the center
+    common::Vertex boxMin( DBL_MAX, DBL_MAX, DBL_MAX);
+    common::Vertex boxMax(-DBL_MAX,-DBL_MAX,-DBL_MAX);
+    for (const common::Vertex &p : vertices)
+    {
+        boxMin = {std::min(boxMin.x, p.x), std::min(boxMin.y, p.y), std::min(boxMin.z, p.z)};
+        boxMax = {std::max(boxMax.x, p.x), std::max(boxMax.y, p.y), std::max(boxMax.z, p.z)};
+    }
+    m_center = vertices.empty() ? common::Vertex() : (boxMin + boxMax) / 2;
+
+    m_verticesOrig.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); ++i)
+        m_verticesOrig[i] = common::VertexF(vertices[i] - m_center);
+    m_vertices = m_verticesOrig;
+    // the double vertices are not needed anymore
+    std::vector<common::Vertex>().swap(vertices);
+
+    return fitModel();
 }
 
-bool Scene3D::fitModel(bool firstLoad)
+void Scene3D::getModel(std::vector<common::Vertex> &vertices,
+                       std::vector<common::Triangle> &faces) const
 {
-    m_totalArea = 0.0;
-    m_supportedTriangles.clear();
-    m_isTriangleSupported.clear();
+    vertices.resize(m_verticesOrig.size());
+    for (size_t i = 0; i < m_verticesOrig.size(); ++i)
+        vertices[i] = common::Vertex(m_verticesOrig[i]) + m_center;
+    faces = m_triangles;
+}
+
+bool Scene3D::setPreview(std::vector<common::Vertex> &&vertices,
+                         std::vector<common::Triangle> &&faces)
+{
+    // the preview has no topology
+    m_edges.clear();
+    m_triangleEdges.clear();
+    m_edgeTriangles.clear();
+    m_vertexTriangles.clear();
+    m_triangleFaces.clear();
+    m_faces.clear();
+    m_mergeTree.clear();
+
+    bool ok = setModel(std::move(vertices), std::move(faces));
+    if (ok)
+    {
+        m_isPreview = true;
+        updateForDraw();
+    }
+    else
+    {
+        // nothing to show
+        m_verticesOrig.clear();
+        m_vertices.clear();
+        m_triangles.clear();
+        m_normalVertices.clear();
+        m_groundVertices.clear();
+        m_drawVertices.clear();
+        m_drawColor.clear();
+    }
+
+    update();
+    return ok;
+}
+
+bool Scene3D::setModel(MeshCacheData &&data)
+{
+    m_isPreview = false;
+    m_arena.release();
+    m_levels.clear();
+    m_clusters.clear();
+    m_clusterEdges.clear();
+    m_vertexBuffer.invalidate();
+    m_triangleBuffer.invalidate();
+    m_edgeBuffer.invalidate();
+    defaultScene();
+    m_supportMask.clear();
+    m_degenerateMask.clear();
+    m_normalZ.clear();
+    m_triangleTopZ.clear();
+    m_triangleFaces.clear();
+    m_faces.clear();
+    m_mergeTree.clear();
+
+    // the cached vertices are already fitted to the center point
+    m_center = data.center;
+    m_verticesOrig = data.vertices;
+    std::swap(m_vertices, data.vertices);
+    std::swap(m_triangles, data.triangles);
+    m_firstFacet = data.firstFacet;
+    std::swap(m_edges, data.edges);
+    std::swap(m_triangleEdges, data.triangleEdges);
+    std::swap(m_normals, data.normals);
+    std::swap(m_triangleArea, data.triangleArea);
+    // the cache keeps the edge-triangle connector in the same layout
+    std::swap(m_edgeTriangles.offsets, data.edgeTriangleOffsets);
+    std::swap(m_edgeTriangles.indices, data.edgeTriangles);
 
-    // if we have no vertices return
     if (m_vertices.empty() || m_triangles.empty())
         return false;
 
-    m_isTriangleSupported.insert(m_isTriangleSupported.begin(), m_triangles.size(), false);
+    buildTriangleAdjacency(m_triangles[0].coord, 3 * m_triangles.size(), m_vertices.size(),
+                           m_vertexTriangles, &m_arena);
 
-    // initiate the maximum and minimum values of X, Y and Z
-    m_boundBoxMin = { DBL_MAX, DBL_MAX, DBL_MAX};
-    m_boundBoxMax = {-DBL_MAX,-DBL_MAX,-DBL_MAX};
-    // loop over the parts
-    for (size_t i = 0; i < m_vertices.size(); ++i)
+    m_supportMask.assign((m_triangles.size() + 63) / 64, 0);
+    m_totalArea = 0.0;
+    m_degenerateMask.assign((m_triangles.size() + 63) / 64, 0);
+    for (uint32_t i = 0; i < m_triangles.size(); ++i)
     {
-        const common::Vertex &p = m_vertices[i];
+        // only the degenerated triangles are stored with zero area
+        if (m_triangleArea[i] == 0.0f)
+            m_degenerateMask[i / 64] |= uint64_t(1) << (i % 64);
+        m_totalArea += m_triangleArea[i];
+    }
+
+    updateBoundBox();
+    fitScale();
+    updateNormalVertices();
+    updateGround();
+    updateForDraw();
+    updateClusters();
+    return true;
+}
+
+void Scene3D::getCacheData(MeshCacheData &data) const
+{
+    data.center = m_center;
+    data.vertices = m_verticesOrig;
+    data.triangles = m_triangles;
+    data.firstFacet = m_firstFacet;
+    data.edges = m_edges;
+    data.triangleEdges = m_triangleEdges;
+    data.normals = m_normals;
+    data.triangleArea = m_triangleArea;
+    data.edgeTriangleOffsets = m_edgeTriangles.offsets;
+    data.edgeTriangles = m_edgeTriangles.indices;
+}
+
+bool Scene3D::fitModel()
+{
+    StageMemoryScope memoryScope("fitModel");
+    m_totalArea = 0.0;
+    m_supportMask.clear();
+    m_degenerateMask.clear();
+    m_normalZ.clear();
+    m_triangleTopZ.clear();
+
+    // if we have no vertices return
+    if (m_vertices.empty() || m_triangles.empty())
+        return false;
+
+    m_supportMask.assign((m_triangles.size() + 63) / 64, 0);
+
+    updateBoundBox();
+    fitScale();
+
+    // calculate normals in double, they are stored packed
+    m_normals.resize(m_triangles.size());
+    m_triangleArea.resize(m_triangles.size());
+    m_degenerateMask.assign((m_triangles.size() + 63) / 64, 0);
+    for (uint32_t i = 0; i < m_triangles.size(); ++i)
+    {
+        const uint32_t *indices = m_triangles[i].coord;
+        common::Vector nor;
+        calculateNormal(m_vertices[indices[0]],
+                        m_vertices[indices[1]],
+                        m_vertices[indices[2]],
+                        nor);
+
+        double area = nor.length();
+        if (!normalize(nor))
+        {
+            // the thin facet of file can lose its area by the rounding of vertices to floats,
+            // it's flagged and has no normal, area and support
+            m_degenerateMask[i / 64] |= uint64_t(1) << (i % 64);
+            m_normals[i] = common::PackedNormal();
+            m_triangleArea[i] = 0.0f;
+            continue;
+        }
+        m_triangleArea[i] = static_cast<float>(area);
+        m_totalArea += area;
+        m_normals[i] = common::PackedNormal(nor);
+    }
+
+    updateNormalVertices();
+    updateGround();
+    return true;
+}
+
+void Scene3D::updateBoundBox()
+{
+    // initiate the maximum and minimum values of X, Y and Z
+    m_boundBoxMin = { DBL_MAX, DBL_MAX, DBL_MAX};
+    m_boundBoxMax = {-DBL_MAX,-DBL_MAX,-DBL_MAX};
+    // loop over the parts
+    for (size_t i = 0; i < m_vertices.size(); ++i)
+    {
+        const common::Vertex p = m_vertices[i];
         // check and replace the maximum and minimum values of X, Y and Z
         if (m_boundBoxMin.x > p.x)
             m_boundBoxMin.x = p.x;
@@ -444,22 +1065,10 @@ bool Scene3D::fitModel(bool firstLoad)
         if (m_boundBoxMax.z < p.z)
             m_boundBoxMax.z = p.z;
     }
+}
 
-    if (firstLoad)
-    {
-        // fit vertices coordinates to the center point
-        {
-            common::Vertex centerPoint = (m_boundBoxMin + m_boundBoxMax) / 2;
-            for (auto &vert : m_vertices)
-                vert -= centerPoint;
-
-            m_boundBoxMin -= centerPoint;
-            m_boundBoxMax -= centerPoint;
-        }
-
-        m_verticesOrig = m_vertices;
-    }
-
+void Scene3D::fitScale()
+{
     auto fixScale = [&](double val)
     {
         if (val > DBL_EPSILON && m_scaleDefault > 1/val)
@@ -471,255 +1080,267 @@ bool Scene3D::fitModel(bool firstLoad)
     fixScale(m_boundBoxMax.y - m_boundBoxMin.y);
     fixScale(m_boundBoxMax.z - m_boundBoxMin.z);
     m_scale = m_scaleDefault;
+}
+
+void Scene3D::updateNormalVertices()
+{
+    m_normalBuffer.invalidate();
+    if (isReleased(shNormals))
+    {
+        std::vector<common::VertexF>().swap(m_normalVertices);
+        return;
+    }
 
     double normalLen = std::max(std::max(
             m_boundBoxMax.x - m_boundBoxMin.x,
             m_boundBoxMax.y - m_boundBoxMin.y),
             m_boundBoxMax.z - m_boundBoxMin.z) / 20;
 
-    // calculate normals
-    m_normals.resize(m_triangles.size());
-    m_triangleArea.resize(m_triangles.size());
-    m_normalIndices.resize(2 * m_triangles.size());
     m_normalVertices.resize(2 * m_triangles.size());
     for (uint32_t i = 0; i < m_triangles.size(); ++i)
     {
         const uint32_t *indices = m_triangles[i].coord;
-        calculateNormal(m_vertices[indices[0]],
-                        m_vertices[indices[1]],
-                        m_vertices[indices[2]],
-                        m_normals[i]);
-
-        m_triangleArea[i] = m_normals[i].length();
-        m_totalArea += m_triangleArea[i];
-
-        if (!normalize(m_normals[i]))
-            return false;
-
         auto I = 2 * i;
-        m_normalVertices[I] = (m_vertices[indices[0]] + m_vertices[indices[1]] + m_vertices[indices[2]]) / 3;
-        m_normalVertices[I + 1] = m_normalVertices[I] + m_normals[i] * normalLen;
-        m_normalIndices[I    ] = I;
-        m_normalIndices[I + 1] = I + 1;
-    }
-
-    // process ground
-    {
-        double minX = m_boundBoxMin.x;
-        double minY = m_boundBoxMin.y;
-        double maxX = m_boundBoxMax.x;
-        double maxY = m_boundBoxMax.y;
-        double lenY = 2.0 * (maxY - minY);
-        double lenX = 2.0 * (maxX - minX);
-        minX -= lenX*0.25;
-        maxX += lenX*0.25;
-        minY -= lenY*0.25;
-        maxY += lenY*0.25;
-
-        double stepSize = 2.0;
-        size_t stepsX = static_cast<size_t>(lenX / stepSize);
-        size_t stepsY = static_cast<size_t>(lenY / stepSize);
-        if (stepsX < 10 || stepsY < 10)
-        {
-            if (stepsX < stepsY)
-            {
-                stepsX = 10;
-                stepSize = lenX / 10;
-                stepsY = static_cast<size_t>(lenY / stepSize);
-            }
-            else
-            {
-                stepsY = 10;
-                stepSize = lenY / 10;
-                stepsX = static_cast<size_t>(lenX / stepSize);
-            }
-        }
+        common::Vertex center = (common::Vertex(m_vertices[indices[0]]) +
+                                 common::Vertex(m_vertices[indices[1]]) +
+                                 common::Vertex(m_vertices[indices[2]])) / 3;
+        m_normalVertices[I] = common::VertexF(center);
+        // the degenerated triangle has no normal to show, its line has zero length
+        m_normalVertices[I + 1] = isDegenerate(i) ? m_normalVertices[I] :
+                                  common::VertexF(center + m_normals[i].unpack() * normalLen);
+    }
+}
 
-        m_groundVertices.clear();
-        m_groundVertices.reserve((stepsX - 2) * (stepsY - 2) * 2);
+void Scene3D::updateGround()
+{
+    m_groundBuffer.invalidate();
+    m_groundVertices.clear();
+    m_groundCoarse = 0;
+    m_groundStep = 0.0;
+    if (isReleased(shGround))
+        std::vector<common::VertexF>().swap(m_groundVertices);
+}
 
-        for (size_t i = 1; i < stepsX; ++i)
-        {
-            double x = minX + i*stepSize;
-            m_groundVertices.push_back({x, minY, m_boundBoxMin.z});
-            m_groundVertices.push_back({x, maxY, m_boundBoxMin.z});
-        }
-        for (size_t i = 1; i < stepsY; ++i)
-        {
-            double y = minY + i*stepSize;
-            m_groundVertices.push_back({minX, y, m_boundBoxMin.z});
-            m_groundVertices.push_back({maxX, y, m_boundBoxMin.z});
-        }
+// Build the grid again if the zoom or the view center is changed
+void Scene3D::updateGroundGrid()
+{
+    if (isReleased(shGround) || m_boundBoxMin.x > m_boundBoxMax.x)
+        return;
+
+    // the fine step adapts to the zoom, but the ground gets enough lines
+    const double extent = 2.0 * std::max(m_boundBoxMax.x - m_boundBoxMin.x, m_boundBoxMax.y - m_boundBoxMin.y);
+    const double viewSize = 2.0 * std::max(m_viewWidth, m_viewHeight) / m_scale;
+    double step = viewSize / GROUND_VIEW_LINES;
+    if (extent > DBL_EPSILON)
+        step = std::max(std::min(step, extent / GROUND_MIN_LINES), extent * 1e-12);
+    if (!(step > DBL_MIN))
+        return;
+    step = roundStepUp(step);
+
+    // the point of ground at the center of view: the modelview matrix (by columns)
+    // maps it to x = y = 0, the ground seen edge-on is centered at the model
+    GLdouble modelview[16];
+    glGetDoublev(GL_MODELVIEW_MATRIX, modelview);
+    const double z = m_boundBoxMin.z;
+    const double det = modelview[0] * modelview[5] - modelview[4] * modelview[1];
+    double centerX = 0.0;
+    double centerY = 0.0;
+    if (fabs(det) > 1e-3 * m_scale * m_scale)
+    {
+        const double bx = -(modelview[8] * z + modelview[12]);
+        const double by = -(modelview[9] * z + modelview[13]);
+        centerX = (bx * modelview[5] - modelview[4] * by) / det;
+        centerY = (modelview[0] * by - bx * modelview[1]) / det;
+    }
+    // the levels are moved by the coarse steps only
+    const double coarseStep = 10.0 * step;
+    centerX = round(std::max(m_boundBoxMin.x, std::min(m_boundBoxMax.x, centerX)) / coarseStep) * coarseStep;
+    centerY = round(std::max(m_boundBoxMin.y, std::min(m_boundBoxMax.y, centerY)) / coarseStep) * coarseStep;
+    if (step == m_groundStep && centerX == m_groundCenterX && centerY == m_groundCenterY)
+        return;
 
-        m_groundIndices.clear();
-        m_groundIndices.resize(m_groundVertices.size());
-        for (uint32_t i = 0; i < m_groundVertices.size(); ++i)
-            m_groundIndices[i] = i;
+    m_groundStep = step;
+    m_groundCenterX = centerX;
+    m_groundCenterY = centerY;
+    m_groundVertices.clear();
+    addGroundLines(coarseStep, 0.5 * GROUND_LEVEL_LINES * coarseStep, false);
+    m_groundCoarse = m_groundVertices.size();
+    addGroundLines(step, 0.5 * GROUND_LEVEL_LINES * step, true);
+    m_groundBuffer.invalidate();
+}
 
+// Add the lines of one level clipped by the ground around the model
+void Scene3D::addGroundLines(double step, double halfSize, bool skipCoarse)
+{
+    // the ground is twice the size of model bounding box
+    const double sizeX = 0.5 * (m_boundBoxMax.x - m_boundBoxMin.x);
+    const double sizeY = 0.5 * (m_boundBoxMax.y - m_boundBoxMin.y);
+    const double minX = std::max(m_boundBoxMin.x - sizeX, m_groundCenterX - halfSize);
+    const double maxX = std::min(m_boundBoxMax.x + sizeX, m_groundCenterX + halfSize);
+    const double minY = std::max(m_boundBoxMin.y - sizeY, m_groundCenterY - halfSize);
+    const double maxY = std::min(m_boundBoxMax.y + sizeY, m_groundCenterY + halfSize);
+    const double z = m_boundBoxMin.z;
+
+    // the lines are at the multiples of step, the fine ones skip the coarse lines
+    for (double i = ceil(minX / step); i * step <= maxX; ++i)
+    {
+        if (skipCoarse && fmod(i, 10.0) == 0.0)
+            continue;
+        m_groundVertices.push_back(common::VertexF(i * step, minY, z));
+        m_groundVertices.push_back(common::VertexF(i * step, maxY, z));
+    }
+    for (double i = ceil(minY / step); i * step <= maxY; ++i)
+    {
+        if (skipCoarse && fmod(i, 10.0) == 0.0)
+            continue;
+        m_groundVertices.push_back(common::VertexF(minX, i * step, z));
+        m_groundVertices.push_back(common::VertexF(maxX, i * step, z));
     }
-    return true;
 }
 
 // Calculate the aspect ratio of given mesh
 bool Scene3D::updateAll()
 {
+    if (m_isPreview)
+        return false;
+
+    StageMemoryScope memoryScope("updateAll");
+    m_arena.reset();
+    // calculate wireframe and triangle-edge connector
+    std::vector<common::Edge> edges;
+    std::vector<uint32_t> triangleEdges;
+    buildEdges(m_triangles, edges, triangleEdges, 0, &m_arena);
+    return updateTopology(std::move(edges), std::move(triangleEdges), m_firstFacet);
+}
+
+bool Scene3D::updateAll(std::vector<common::Edge> &&edges,
+                        std::vector<uint32_t> &&triangleEdges, uint32_t firstFacet)
+{
+    StageMemoryScope memoryScope("updateAll");
+    m_arena.reset();
+    return updateTopology(std::move(edges), std::move(triangleEdges), firstFacet);
+}
+
+bool Scene3D::updateTopology(std::vector<common::Edge> &&edges,
+                             std::vector<uint32_t> &&triangleEdges, uint32_t firstFacet)
+{
+    m_firstFacet = firstFacet < m_triangles.size() ? firstFacet : 0;
     m_triangleFaces.clear();
     m_faces.clear();
+    m_mergeTree.clear();
     m_drawVertices.clear();
-    m_drawTriangles.clear();
     m_drawColor.clear();
-    m_edges.clear();
-    m_triangleEdges.clear();
+    m_clusters.clear();
+    m_clusterEdges.clear();
+    std::swap(m_edges, edges);
+    std::swap(m_triangleEdges, triangleEdges);
+    // the orientation of triangles is fixed below
+    m_edgeBuffer.invalidate();
+    m_triangleBuffer.invalidate();
 
     // if we have no vertices return
-    if (m_vertices.empty() || m_triangles.empty())
+    if (m_vertices.empty() || m_triangles.empty() ||
+        m_triangleEdges.size() != 3*m_triangles.size())
         return false;
 
-    // calculate wireframe and triangle-edge connector
-    m_edges.reserve(m_triangles.size());
-    m_triangleEdges.reserve(3*m_triangles.size());
-
-    std::unordered_map<uint64_t, uint32_t> pairs;
-    for (const common::Triangle &tri : m_triangles)
-    {
-        for (int i = 0; i < 3; ++i)
-        {
-            uint32_t i1 = tri.coord[i];
-            uint32_t i2 = tri.coord[(i+1)%3];
-            uint64_t pair;
-            pair = i1;
-            pair = (pair << 32) + i2;
-            auto it = pairs.find(pair);
-            if (it != pairs.end())
-            {
-                m_triangleEdges.push_back(it->second);
-                continue;
-            }
-
-            pair = i2;
-            pair = (pair << 32) + i1;
-            it = pairs.find(pair);
-            if (it != pairs.end())
-            {
-                m_triangleEdges.push_back(it->second);
-                continue;
-            }
-
-            pairs[pair] = static_cast<uint32_t>(m_edges.size());
-            m_triangleEdges.push_back(static_cast<uint32_t>(m_edges.size()));
-            m_edges.push_back({i1, i2});
-        }
-    }
-
-    // fill edge-triangle connector
-    m_edgeTriangles.clear();
-    m_edgeTriangles.resize(m_edges.size());
-    for (uint32_t i = 0; i < m_triangleEdges.size(); ++i)
-    {
-        m_edgeTriangles[m_triangleEdges[i]].push_back(i/3);
-    }
+    // fill edge-triangle and vertex-triangle connectors
+    updateAdjacency();
 
     // it's time to fix triangle normals' orientations
     fixTrianglesOrientation();
 
     updateForDraw();
+    updateClusters();
 
     return true;
 }
 
+void Scene3D::updateAdjacency()
+{
+    buildTriangleAdjacency(m_triangleEdges.data(), m_triangleEdges.size(), m_edges.size(),
+                           m_edgeTriangles, &m_arena);
+    buildTriangleAdjacency(m_triangles[0].coord, 3 * m_triangles.size(), m_vertices.size(),
+                           m_vertexTriangles, &m_arena);
+}
+
 void Scene3D::changeOrientation()
 {
+    if (m_isPreview)
+        return;
+
     for (auto &tri : m_triangles)
         std::swap(tri.coord[0], tri.coord[1]);
 
     fitModel();
     updateAll();
-    updateGL();
+    update();
 }
 
-bool Scene3D::poligonize(double angleInRadians)
+bool Scene3D::poligonize(double minCosine)
 {
-    if (m_triangles.empty())
+    if (m_isPreview || m_triangles.empty() || m_edgeTriangles.empty())
         return false;
 
-    m_faces.clear();
-    m_triangleFaces.resize(m_triangles.size());
-
-    std::unordered_set<uint32_t> visited;
-    for (uint32_t iStartTri = 0; iStartTri < m_triangles.size(); ++iStartTri)
+    StageMemoryScope memoryScope("poligonize");
+    m_arena.reset();
+    // the merge tree is built once for the model, then any threshold costs one pass
+    if (m_mergeTree.empty())
+        buildMergeTree(m_normals, m_edgeTriangles, m_mergeTree, 0, &m_arena, m_degenerateMask.data());
+    segmentByMergeTree(m_mergeTree, m_triangles.size(), minCosine, m_faces, m_triangleFaces, &m_arena);
+
+    // the color is random by the first triangle of face, so the face keeps its color
+    // while the threshold is changed, and the merged face takes the color of first one
+    m_faceColors.resize(m_faces.size());
+    for (size_t i = 0; i < m_faces.size(); ++i)
     {
-        if (visited.find(iStartTri) != visited.end())
-            continue;
-
-        std::vector<uint32_t> singleFace;
-        singleFace.push_back(iStartTri);
-        visited.insert(iStartTri);
-        m_triangleFaces[iStartTri] = static_cast<uint32_t>(m_faces.size());
-        for (uint32_t i = 0; i < singleFace.size(); ++i)
-        {
-            uint32_t iTri = singleFace[i];
-            const common::Vector &normal = m_normals[iTri];
-            uint32_t*edges = &m_triangleEdges[3*iTri];
-            for (uint32_t j = 0; j < 3; ++j)
-            {
-                uint32_t iEdge = edges[j];
-                const std::vector<uint32_t> &edgeTriangles = m_edgeTriangles[iEdge];
-                for (uint32_t iNeigh : edgeTriangles)
-                {
-                    if (iNeigh == iTri)
-                        continue;
-                    if (visited.find(iNeigh) != visited.end())
-                        continue;
-                    const common::Vector &neighNormal = m_normals[iNeigh];
-                    if (normal * neighNormal < angleInRadians)
-                        continue;
-                    singleFace.push_back(iNeigh);
-                    visited.insert(iNeigh);
-                    m_triangleFaces[iNeigh] = static_cast<uint32_t>(m_faces.size());
-                }
-            }
-        }
-        m_faces.push_back(std::move(singleFace));
+        uint64_t hash = m_faces.indices[m_faces.offsets[i]] + 0x9E3779B97F4A7C15ull;
+        hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+        hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+        hash ^= hash >> 31;
+        Color &color = m_faceColors[i];
+        color.r = static_cast<uint8_t>(hash);
+        color.g = static_cast<uint8_t>(hash >> 8);
+        color.b = static_cast<uint8_t>(hash >> 16);
+        color.a = 255;
     }
 
-    updateForDraw();
-    updateGL();
+    // only the colors are changed
+    updateDrawColors();
+    update();
 
     return true;
 }
 
-double Scene3D::detectSupportedTriangles()
+double Scene3D::detectSupportedTriangles(double overhangAngle)
 {
-    double area = 0.0;
-    double cosValue = -cos(45.0);
-    m_supportedTriangles.clear();
-    m_isTriangleSupported.clear();
-    m_isTriangleSupported.reserve(m_normals.size());
-
-    for (uint32_t i = 0; i < m_normals.size(); ++i)
+    if (m_isPreview)
+        return 0.0;
+
+    m_arena.reset();
+    updateOverhangData();
+    std::pmr::vector<uint64_t> wasSupported(m_supportMask.begin(), m_supportMask.end(), &m_arena);
+    wasSupported.resize((m_triangles.size() + 63) / 64, 0);
+    m_supportMask.resize(wasSupported.size());
+
+    // the triangles lying on the ground don't need support
+    const float maxNormalZ = static_cast<float>(-cos(overhangAngle * M_PI / 180.0));
+    const float groundLevel = static_cast<float>(m_boundBoxMin.z + m_groundHeight);
+    double area = detectOverhangs(m_normalZ.data(), m_triangleTopZ.data(), m_triangleArea.data(),
+                                  m_triangles.size(), maxNormalZ, groundLevel, m_supportMask.data());
+
+    // recolor only the triangles which have changed their state
+    std::pmr::vector<uint32_t> changed(&m_arena);
+    for (size_t word = 0; word < m_supportMask.size(); ++word)
     {
-        const uint32_t *tri = m_triangles[i].coord;
-        if (vertexOnTheGround(tri[0]) && vertexOnTheGround(tri[1]) && vertexOnTheGround(tri[2]))
-        {
-            m_isTriangleSupported.push_back(false);
-            continue; // doesn't need support as it lies on the ground
-        }
-
-        const common::Vector &nor = m_normals[i];
-        if (nor.z < cosValue)
-        {
-            m_supportedTriangles.push_back(i);
-            m_isTriangleSupported.push_back(true);
-            area += m_triangleArea[i];
-        }
-        else
-        {
-            m_isTriangleSupported.push_back(false);
-        }
+        const uint64_t bits = m_supportMask[word] ^ wasSupported[word];
+        if (bits == 0)
+            continue;
+        for (uint32_t j = 0; j < 64; ++j)
+            if (bits >> j & 1)
+                changed.push_back(static_cast<uint32_t>(64 * word + j));
     }
-
-    updateForDraw();
-    updateGL();
+    updateDrawColors(changed);
+    update();
 
     return area;
 }
@@ -728,6 +1349,10 @@ void Scene3D::keyPressEvent(QKeyEvent *pe)
 {
     if (QApplication::keyboardModifiers().testFlag(Qt::ShiftModifier) == true)
     {
+        // the preview can't be rotated, the loading thread builds the model meanwhile
+        if (m_isPreview)
+            return;
+
         switch (pe->key())
         {
         case Qt::Key_S:     rotateModelUpX();      break;
@@ -760,17 +1385,20 @@ void Scene3D::keyPressEvent(QKeyEvent *pe)
         default: return;
         }
     }
-    updateGL();
+    requestFrame();
 }
 
 void Scene3D::keyReleaseEvent(QKeyEvent *re)
 {
-    if (re->key() == Qt::Key_Shift && m_needsUpdate)
+    if (re->key() == Qt::Key_Shift && m_needsUpdate && !m_isPreview)
     {
+        // the vertices, normals, bounding box and ground get the rotation once
+        if (m_bakedDirection != m_buildDirection)
+            applyModelRotation();
         m_needsUpdate = false;
         fitModel();
         updateAll();
-        updateGL();
+        update();
     }
 }
 
@@ -783,16 +1411,35 @@ void Scene3D::drawWireframe()
     // check do the mesh exist
     if (m_vertices.empty())
         return;
+    // upload the changes only
+    m_vertexBuffer.upload(this, m_vertices);
+    m_edgeBuffer.upload(this, m_edges);
+    if (m_edgeBuffer.isEmpty())
+        return;
+
     // to use the arrays of colors for drawing
     glDisableClientState(GL_COLOR_ARRAY);
     // draw black wireframe
     glColor3ub(20, 20, 20);
     // set the line width
     glLineWidth(1.0f);
-    // set the vertices
-    glVertexPointer(3, GL_DOUBLE, 0, m_vertices.data());
+    // set the vertices, the pointers are the offsets in the bound buffers
+    m_vertexBuffer.bind(this);
+    glVertexPointer(3, GL_FLOAT, 0, nullptr);
+    m_vertexBuffer.release(this);
     // set the edges
-    glDrawElements(GL_LINES, static_cast<GLsizei>(m_edges.size())*2, GL_UNSIGNED_INT, m_edges.data());
+    m_edgeBuffer.bind(this);
+    if (m_clusters.empty())
+    {
+        glDrawElements(GL_LINES, static_cast<GLsizei>(m_edges.size())*2, GL_UNSIGNED_INT, nullptr);
+    }
+    else
+    {
+        // the edges of clusters in view, the back faces don't hide their edges
+        setEdgeRanges(m_edgeRuns, 2);
+        drawIndexedRanges(GL_LINES);
+    }
+    m_edgeBuffer.release(this);
 }
 
 // Draw the facets of mesh
@@ -805,27 +1452,61 @@ void Scene3D::drawTriangles()
     if (m_vertices.empty())
         return;
 
-    const common::Vertex *vert;
-    const common::Triangle *tria;
-    if (m_drawVertices.empty())
-    {
-        vert = m_vertices.data();
-        tria = m_triangles.data();
-    }
-    else
+    // the clusters culled by cullClusters() are not drawn, the back faces
+    // of the drawn ones are culled by OpenGL
+    if (m_backFaceCulling)
+        glEnable(GL_CULL_FACE);
+    if (m_drawVertices.empty() || m_drawColor.size() != m_drawVertices.size())
     {
-        vert = m_drawVertices.data();
-        tria = m_drawTriangles.data();
+        // no colors are prepared, draw the indexed facets by one color
+        m_vertexBuffer.upload(this, m_vertices);
+        m_triangleBuffer.upload(this, m_triangles);
+        glDisableClientState(GL_COLOR_ARRAY);
+        glColor3ub(50, 170, 128);
+        m_vertexBuffer.bind(this);
+        glVertexPointer(3, GL_FLOAT, 0, nullptr);
+        m_vertexBuffer.release(this);
+        m_triangleBuffer.bind(this);
+        if (m_clusters.empty())
+        {
+            glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(3*m_triangles.size()),
+                           GL_UNSIGNED_INT, nullptr);
+        }
+        else
+        {
+            setTriangleRanges(m_triangleRuns, 3);
+            drawIndexedRanges(GL_TRIANGLES);
+        }
+        m_triangleBuffer.release(this);
+        glDisable(GL_CULL_FACE);
+        return;
     }
+    // the indices are needed for the facets without colors only
+    m_triangleBuffer.destroy(this);
+
+    m_drawVertexBuffer.upload(this, m_drawVertices);
+    m_drawColorBuffer.upload(this, m_drawColor);
 
     glEnableClientState(GL_COLOR_ARRAY);
     // set the vertices
-    glVertexPointer(3, GL_DOUBLE, 0, vert);
+    m_drawVertexBuffer.bind(this);
+    glVertexPointer(3, GL_FLOAT, 0, nullptr);
     // set the colors
-    glColorPointer(4, GL_UNSIGNED_BYTE, 0, m_drawColor.data());
-    // set the facets
-    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(3*m_triangles.size()),
-                   GL_UNSIGNED_INT, tria);}
+    m_drawColorBuffer.bind(this);
+    glColorPointer(4, GL_UNSIGNED_BYTE, 0, nullptr);
+    m_drawColorBuffer.release(this);
+    // the vertices are in the order of facets
+    if (m_clusters.empty())
+    {
+        glDrawArrays(GL_TRIANGLES, 0, static_cast<GLsizei>(m_drawVertices.size()));
+    }
+    else
+    {
+        setTriangleRanges(m_triangleRuns, 3);
+        drawRanges(GL_TRIANGLES);
+    }
+    glDisable(GL_CULL_FACE);
+}
 
 // Draw the facets of mesh
 void Scene3D::drawNormals()
@@ -837,13 +1518,16 @@ void Scene3D::drawNormals()
     if (m_normalVertices.empty())
         return;
 
+    m_normalBuffer.upload(this, m_normalVertices);
+
     glDisableClientState(GL_COLOR_ARRAY);
     glColor3ub(0, 0, 255);
     // set the vertices
-    glVertexPointer(3, GL_DOUBLE, 0, m_normalVertices.data());
-    // set the facets
-    glDrawElements(GL_LINES, static_cast<GLsizei>(m_normalIndices.size()),
-                   GL_UNSIGNED_INT, m_normalIndices.data());
+    m_normalBuffer.bind(this);
+    glVertexPointer(3, GL_FLOAT, 0, nullptr);
+    m_normalBuffer.release(this);
+    // every two vertices are the line
+    glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(m_normalVertices.size()));
 }
 
 // Draw the facets of mesh
@@ -852,16 +1536,289 @@ void Scene3D::drawGround()
     if(!(m_showMask & shGround))
         return;
 
+    updateGroundGrid();
     if (m_groundVertices.empty())
         return;
 
+    m_groundBuffer.upload(this, m_groundVertices);
+
     glDisableClientState(GL_COLOR_ARRAY);
-    glColor4ub(100, 100, 200, 200);
     // set the vertices
-    glVertexPointer(3, GL_DOUBLE, 0, m_groundVertices.data());
-    // set the facets
-    glDrawElements(GL_LINES, static_cast<GLsizei>(m_groundIndices.size()),
-                   GL_UNSIGNED_INT, m_groundIndices.data());
+    m_groundBuffer.bind(this);
+    glVertexPointer(3, GL_FLOAT, 0, nullptr);
+    m_groundBuffer.release(this);
+    // every two vertices are the line, the fine lines are lighter
+    glColor4ub(100, 100, 200, 200);
+    glDrawArrays(GL_LINES, 0, static_cast<GLsizei>(m_groundCoarse));
+    glColor4ub(100, 100, 200, 90);
+    glDrawArrays(GL_LINES, static_cast<GLint>(m_groundCoarse),
+                 static_cast<GLsizei>(m_groundVertices.size() - m_groundCoarse));
+}
+
+// Draw the simplified level instead of the model
+void Scene3D::drawLevel(const common::MeshLevel &level)
+{
+    if (!(m_showMask & (shTriangles | shWireframe)))
+        return;
+
+    size_t index = static_cast<size_t>(&level - m_levels.data());
+    if (index != m_uploadedLevel)
+    {
+        m_levelVertexBuffer.invalidate();
+        m_levelTriangleBuffer.invalidate();
+        m_uploadedLevel = index;
+    }
+    m_levelVertexBuffer.upload(this, level.vertices);
+    m_levelTriangleBuffer.upload(this, level.triangles);
+
+    glDisableClientState(GL_COLOR_ARRAY);
+    m_levelVertexBuffer.bind(this);
+    glVertexPointer(3, GL_FLOAT, 0, nullptr);
+    m_levelVertexBuffer.release(this);
+    m_levelTriangleBuffer.bind(this);
+    const GLsizei count = static_cast<GLsizei>(3*level.triangles.size());
+    if (m_showMask & shTriangles)
+    {
+        glColor3ub(50, 170, 128);
+        if (m_backFaceCulling)
+            glEnable(GL_CULL_FACE);
+        glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, nullptr);
+        glDisable(GL_CULL_FACE);
+    }
+    if (m_showMask & shWireframe)
+    {
+        // the edges of level are drawn by its triangles
+        glColor3ub(20, 20, 20);
+        glLineWidth(1.0f);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+        glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_INT, nullptr);
+        glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
+    }
+    m_levelTriangleBuffer.release(this);
+}
+
+// Split the triangles into clusters by their order
+void Scene3D::updateClusters()
+{
+    m_clusters.clear();
+    m_clusterEdges.clear();
+    if (m_triangles.empty() || m_triangleEdges.size() != 3*m_triangles.size())
+        return;
+
+    const size_t nClusters = (m_triangles.size() + CLUSTER_TRIANGLES - 1) / CLUSTER_TRIANGLES;
+    m_clusters.resize(nClusters);
+    parallelFor(nClusters, [this](size_t begin, size_t end)
+    {
+        common::Vector normals[CLUSTER_TRIANGLES];
+        for (size_t c = begin; c < end; ++c)
+        {
+            const size_t first = c * CLUSTER_TRIANGLES;
+            const size_t last = std::min(m_triangles.size(), first + CLUSTER_TRIANGLES);
+
+            // the sphere around the bounding box of triangles
+            common::Vertex boxMin( DBL_MAX, DBL_MAX, DBL_MAX);
+            common::Vertex boxMax(-DBL_MAX,-DBL_MAX,-DBL_MAX);
+            for (size_t i = first; i < last; ++i)
+            {
+                for (uint32_t index : m_triangles[i].coord)
+                {
+                    const common::Vertex p = m_vertices[index];
+                    boxMin = {std::min(boxMin.x, p.x), std::min(boxMin.y, p.y), std::min(boxMin.z, p.z)};
+                    boxMax = {std::max(boxMax.x, p.x), std::max(boxMax.y, p.y), std::max(boxMax.z, p.z)};
+                }
+            }
+            const common::Vertex center = (boxMin + boxMax) / 2;
+            double radius = 0.0;
+            for (size_t i = first; i < last; ++i)
+                for (uint32_t index : m_triangles[i].coord)
+                    radius = std::max(radius, common::Vector(center, m_vertices[index]).length());
+
+            // the normals by the current order of vertices (the orientation may be fixed
+            // after the stored normals are calculated), the degenerate triangles are skipped
+            common::Vector axis;
+            size_t nNormals = 0;
+            for (size_t i = first; i < last; ++i)
+            {
+                const uint32_t *indices = m_triangles[i].coord;
+                common::Vector nor;
+                calculateNormal(m_vertices[indices[0]], m_vertices[indices[1]],
+                                m_vertices[indices[2]], nor);
+                if (!normalize(nor))
+                    continue;
+                normals[nNormals++] = nor;
+                axis += nor;
+            }
+            double minDot = -1.0;
+            if (normalize(axis))
+            {
+                minDot = 1.0;
+                for (size_t i = 0; i < nNormals; ++i)
+                    minDot = std::min(minDot, axis * normals[i]);
+            }
+
+            Cluster &cluster = m_clusters[c];
+            cluster.center[0] = static_cast<float>(center.x);
+            cluster.center[1] = static_cast<float>(center.y);
+            cluster.center[2] = static_cast<float>(center.z);
+            cluster.radius = static_cast<float>(radius);
+            cluster.axis[0] = static_cast<float>(axis.x);
+            cluster.axis[1] = static_cast<float>(axis.y);
+            cluster.axis[2] = static_cast<float>(axis.z);
+            cluster.coneSin = minDot > 0.0 ? static_cast<float>(sqrt(1.0 - minDot * minDot)) : 1.0f;
+        }
+    }, 64);
+
+    // the edges are numbered in the order of their first triangles,
+    // so the edges first used by the cluster follow the ones of previous clusters
+    m_clusterEdges.resize(nClusters + 1);
+    uint32_t next = 0;
+    for (size_t c = 0; c < nClusters; ++c)
+    {
+        m_clusterEdges[c] = next;
+        const size_t first = 3 * c * CLUSTER_TRIANGLES;
+        const size_t last = std::min(m_triangleEdges.size(), first + 3 * CLUSTER_TRIANGLES);
+        for (size_t i = first; i < last; ++i)
+            next = std::max(next, m_triangleEdges[i] + 1);
+    }
+    m_clusterEdges[nClusters] = next;
+}
+
+// Find the clusters to draw by the current model-view matrix
+void Scene3D::cullClusters()
+{
+    m_triangleRuns.clear();
+    m_edgeRuns.clear();
+    m_cullStats = CullStats();
+    m_cullStats.clusters = m_clusters.size();
+    if (m_clusters.empty())
+    {
+        m_cullStats.submittedTriangles = m_triangles.size();
+        m_cullStats.submittedEdges = m_edges.size();
+        return;
+    }
+
+    GLdouble mv[16];
+    glGetDoublev(GL_MODELVIEW_MATRIX, mv);
+    // the matrix is stored by columns, the scale is the same by all axes
+    const double scale = sqrt(mv[0]*mv[0] + mv[1]*mv[1] + mv[2]*mv[2]);
+    // the direction to the viewer in the model coordinates (the projection is orthographic)
+    common::Vector view(mv[2], mv[6], mv[10]);
+    const bool cullBack = m_backFaceCulling && normalize(view);
+
+    auto addRun = [](std::vector<ClusterRun> &runs, uint32_t c)
+    {
+        if (!runs.empty() && runs.back().end == c)
+            ++runs.back().end;
+        else
+            runs.push_back({c, c + 1});
+    };
+    for (uint32_t c = 0; c < m_clusters.size(); ++c)
+    {
+        const Cluster &cluster = m_clusters[c];
+        if (m_frustumCulling)
+        {
+            const float *p = cluster.center;
+            const double x = mv[0]*p[0] + mv[4]*p[1] + mv[8]*p[2] + mv[12];
+            const double y = mv[1]*p[0] + mv[5]*p[1] + mv[9]*p[2] + mv[13];
+            const double z = mv[2]*p[0] + mv[6]*p[1] + mv[10]*p[2] + mv[14];
+            const double r = cluster.radius * scale;
+            // the view box of glOrtho() in setProjection()
+            if (fabs(x) > m_viewWidth + r || fabs(y) > m_viewHeight + r ||
+                z < -1.0 - r || z > 10.0 + r)
+            {
+                ++m_cullStats.frustumCulled;
+                continue;
+            }
+        }
+        addRun(m_edgeRuns, c);
+
+        // all normals of the cone look away from the viewer (with the margin for float precision)
+        if (cullBack)
+        {
+            const float *axis = cluster.axis;
+            const double dot = axis[0]*view.x + axis[1]*view.y + axis[2]*view.z;
+            if (dot < -cluster.coneSin - 1E-3)
+            {
+                ++m_cullStats.backFaceCulled;
+                continue;
+            }
+        }
+        addRun(m_triangleRuns, c);
+    }
+
+    for (const ClusterRun &run : m_triangleRuns)
+        m_cullStats.submittedTriangles += std::min(m_triangles.size(), size_t(run.end) * CLUSTER_TRIANGLES) -
+                size_t(run.begin) * CLUSTER_TRIANGLES;
+    for (const ClusterRun &run : m_edgeRuns)
+        m_cullStats.submittedEdges += m_clusterEdges[run.end] - m_clusterEdges[run.begin];
+    m_cullStats.culledTriangles = m_triangles.size() - m_cullStats.submittedTriangles;
+    m_cullStats.culledEdges = m_edges.size() - m_cullStats.submittedEdges;
+}
+
+void Scene3D::setTriangleRanges(const std::vector<ClusterRun> &runs, size_t unit)
+{
+    m_drawFirst.clear();
+    m_drawCount.clear();
+    for (const ClusterRun &run : runs)
+    {
+        size_t first = size_t(run.begin) * CLUSTER_TRIANGLES;
+        size_t last = std::min(m_triangles.size(), size_t(run.end) * CLUSTER_TRIANGLES);
+        m_drawFirst.push_back(static_cast<GLint>(unit * first));
+        m_drawCount.push_back(static_cast<GLsizei>(unit * (last - first)));
+    }
+}
+
+void Scene3D::setEdgeRanges(const std::vector<ClusterRun> &runs, size_t unit)
+{
+    m_drawFirst.clear();
+    m_drawCount.clear();
+    for (const ClusterRun &run : runs)
+    {
+        // the cluster may have no edges of its own
+        size_t first = m_clusterEdges[run.begin];
+        size_t last = m_clusterEdges[run.end];
+        if (last == first)
+            continue;
+        m_drawFirst.push_back(static_cast<GLint>(unit * first));
+        m_drawCount.push_back(static_cast<GLsizei>(unit * (last - first)));
+    }
+}
+
+// Draw the ranges of the bound arrays
+void Scene3D::drawRanges(GLenum mode)
+{
+    if (m_drawFirst.empty())
+        return;
+
+    if (m_multiDrawArrays != nullptr)
+    {
+        m_multiDrawArrays(mode, m_drawFirst.data(), m_drawCount.data(),
+                          static_cast<GLsizei>(m_drawFirst.size()));
+        return;
+    }
+    for (size_t i = 0; i < m_drawFirst.size(); ++i)
+        glDrawArrays(mode, m_drawFirst[i], m_drawCount[i]);
+}
+
+// Draw the ranges of the bound index buffer
+void Scene3D::drawIndexedRanges(GLenum mode)
+{
+    if (m_drawFirst.empty())
+        return;
+
+    // the pointers are the offsets in the index buffer
+    m_drawOffsets.resize(m_drawFirst.size());
+    for (size_t i = 0; i < m_drawFirst.size(); ++i)
+        m_drawOffsets[i] = reinterpret_cast<const void*>(m_drawFirst[i] * sizeof(uint32_t));
+
+    if (m_multiDrawElements != nullptr)
+    {
+        m_multiDrawElements(mode, m_drawCount.data(), GL_UNSIGNED_INT, m_drawOffsets.data(),
+                            static_cast<GLsizei>(m_drawFirst.size()));
+        return;
+    }
+    for (size_t i = 0; i < m_drawFirst.size(); ++i)
+        glDrawElements(mode, m_drawCount[i], GL_UNSIGNED_INT, m_drawOffsets[i]);
 }
 
 bool Scene3D::fixTrianglesOrientation(const common::Triangle &tria1, common::Triangle &tria2,
@@ -916,30 +1873,28 @@ void Scene3D::fixTrianglesOrientation()
         return;
 
     uint32_t fixedNumber = 0;
-    std::unordered_set<uint32_t> visited;
-    std::vector<uint32_t> triangles;
+    std::pmr::vector<bool> visited(m_triangles.size(), false, &m_arena);
+    std::pmr::vector<uint32_t> triangles(&m_arena);
     triangles.reserve(m_triangles.size());
-    triangles.push_back(0);
+    // the first facet of file keeps its orientation as before the spatial sort
+    triangles.push_back(m_firstFacet);
     for (uint32_t i = 0; i < triangles.size(); ++i)
     {
         uint32_t iTri = triangles[i];
         const common::Triangle &tria = m_triangles[iTri];
-        std::vector<uint32_t> neighbors;
 
         const uint32_t *edges = &m_triangleEdges[3*iTri];
         for (uint8_t j = 0; j < 3; ++j)
         {
             uint32_t iEdge = edges[j];
-            const std::vector<uint32_t> &neighbors = m_edgeTriangles[iEdge];
-            for (uint32_t k = 0; k < neighbors.size(); ++k)
+            for (uint32_t iNeighbor : m_edgeTriangles[iEdge])
             {
-                uint32_t iNeighbor = neighbors[k];
-                if (iNeighbor == iTri || visited.find(iNeighbor) != visited.end())
+                if (iNeighbor == iTri || visited[iNeighbor])
                     continue;
-                if (fixTrianglesOrientation(tria, m_triangles[neighbors[k]], m_edges[iEdge]))
+                if (fixTrianglesOrientation(tria, m_triangles[iNeighbor], m_edges[iEdge]))
                     ++fixedNumber;
                 triangles.push_back(iNeighbor);
-                visited.insert(iNeighbor);
+                visited[iNeighbor] = true;
             }
         }
     }
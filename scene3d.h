@@ -1,9 +1,14 @@
 #pragma once
 
 #include "common.h"
+#include "meshcache.h"
+#include "modelarena.h"
+#include "gpubuffer.h"
 #include <vector>
-#include <unordered_set>
-#include <QtOpenGL/QGLWidget>
+#include <QOpenGLWidget>
+#include <QOpenGLFunctions>
+#include <QTimer>
+#include <QElapsedTimer>
 
 // The masks of 'elements visibility' variable
 #define shAxis      0x01
@@ -12,37 +17,138 @@
 #define shNormals   0x08
 #define shGround    0x10
 
+// the model with more triangles is drawn by its simplified level while the view is changed
+#define LOD_INTERACTIVE_TRIANGLES 1000000
+// the number of simplified levels, every level has 1/LOD_FACTOR of triangles of the previous one
+#define LOD_LEVELS 3
+#define LOD_FACTOR 4
+// the time (ms) after the last change of view to draw the full model again
+#define LOD_IDLE_DELAY 300
+// the number of triangles in the cluster culled at once
+#define CLUSTER_TRIANGLES 128
+// the time (ms) between the frames drawn by input if the display gives no refresh rate
+#define FRAME_DEFAULT_INTERVAL 16
+// the ground grid has about GROUND_VIEW_LINES fine lines across the view and at least
+// GROUND_MIN_LINES across the ground, each of two levels (the coarse lines are every
+// 10th fine one) has up to GROUND_LEVEL_LINES lines by each axis around the view center
+#define GROUND_VIEW_LINES 20
+#define GROUND_MIN_LINES 10
+#define GROUND_LEVEL_LINES 100
+
 // Scene3D class to 3D objects visualization using Qt
-class Scene3D : public QGLWidget
+class Scene3D : public QOpenGLWidget, protected QOpenGLFunctions
 {
 private:
     // general data
-    std::vector<common::Vertex>        m_verticesOrig;
-    std::vector<common::Vertex>        m_vertices;
+    // the vertices are stored relative to the center of model
+    common::Vertex                     m_center;
+    std::vector<common::VertexF>       m_verticesOrig;
+    std::vector<common::VertexF>       m_vertices;
     std::vector<common::Triangle>      m_triangles;
-    std::vector<common::Vector>        m_normals;
-    std::vector<double>                m_triangleArea;
-    std::vector<common::Vertex>        m_normalVertices;
-    std::vector<uint32_t>              m_normalIndices;
+    uint32_t                           m_firstFacet;     // the triangle which is the first facet of file
+    std::vector<common::PackedNormal>  m_normals;
+    std::vector<float>                 m_triangleArea;
+    std::vector<common::VertexF>       m_normalVertices;
     std::vector<common::Edge>          m_edges;
     std::vector<uint32_t>              m_triangleEdges;
-    std::vector<std::vector<uint32_t>> m_edgeTriangles;
+    common::Adjacency                  m_edgeTriangles;   // the triangles of edges
+    common::Adjacency                  m_vertexTriangles; // the triangles of vertices
     std::vector<uint32_t>              m_triangleFaces;
-    std::vector<std::vector<uint32_t>> m_faces;
-    std::vector<uint32_t>              m_supportedTriangles;
-    std::vector<bool>                  m_isTriangleSupported;
+    common::Adjacency                  m_faces;           // the triangles of faces
+    common::MergeTree                  m_mergeTree;       // to split the faces by any angle
+    // the temporary arrays of operations, reset at the start of every operation
+    ModelArena                         m_arena;
+    // bit i is set if triangle i needs support
+    std::vector<uint64_t>              m_supportMask;
+    // bit i is set if triangle i has no normal: its float vertices are rounded onto one line
+    std::vector<uint64_t>              m_degenerateMask;
+    // the copies for the detection of supported triangles, empty if the model is changed
+    std::vector<float>                 m_normalZ;
+    std::vector<float>                 m_triangleTopZ;   // the highest vertex of triangle
     double                             m_totalArea;
     double                             m_groundHeight;
     common::Vertex                     m_boundBoxMin;
     common::Vertex                     m_boundBoxMax;
-    std::vector<common::Vertex>        m_groundVertices;
-    std::vector<uint32_t>              m_groundIndices;
-    // drawing helpers
-    std::vector<common::Vertex>        m_drawVertices;
-    std::vector<common::Triangle>      m_drawTriangles;
-    std::vector<uint8_t>               m_drawColor;
+    std::vector<common::VertexF>       m_groundVertices; // the coarse lines, then the fine ones
+    size_t                             m_groundCoarse;   // the vertices of coarse lines
+    double                             m_groundStep;     // the step of fine lines, 0 if the grid is not built
+    double                             m_groundCenterX;  // the center of grid levels
+    double                             m_groundCenterY;
+    // drawing helpers: the vertices and colors of triangle i are 3*i .. 3*i + 2,
+    // so the positions and the colors are updated independently
+    struct Color
+    {
+        uint8_t r;
+        uint8_t g;
+        uint8_t b;
+        uint8_t a;
+    };
+    std::vector<common::VertexF>       m_drawVertices;
+    std::vector<Color>                 m_drawColor;
+    std::vector<Color>                 m_faceColors;
+    // the copies of drawn arrays on GPU, the arrays above are changed and marked
+    // in the buffers which upload the changes before the next frame
+    GpuBuffer                          m_vertexBuffer{GL_ARRAY_BUFFER};
+    GpuBuffer                          m_edgeBuffer{GL_ELEMENT_ARRAY_BUFFER};
+    GpuBuffer                          m_triangleBuffer{GL_ELEMENT_ARRAY_BUFFER};
+    GpuBuffer                          m_drawVertexBuffer{GL_ARRAY_BUFFER};
+    GpuBuffer                          m_drawColorBuffer{GL_ARRAY_BUFFER, GL_DYNAMIC_DRAW};
+    GpuBuffer                          m_normalBuffer{GL_ARRAY_BUFFER};
+    GpuBuffer                          m_groundBuffer{GL_ARRAY_BUFFER};
+    // the simplified levels are in the coordinates of m_verticesOrig,
+    // the analysis always works on the full model
+    std::vector<common::MeshLevel>     m_levels;
+    size_t                             m_uploadedLevel;  // the level in the buffers
+    GpuBuffer                          m_levelVertexBuffer{GL_ARRAY_BUFFER};
+    GpuBuffer                          m_levelTriangleBuffer{GL_ELEMENT_ARRAY_BUFFER};
+    QTimer                             m_idleTimer;      // the end of view changing
+    bool                               m_interacting;
+    // the clusters are the runs of CLUSTER_TRIANGLES triangles (the triangles are
+    // sorted spatially by loading), cluster i has the triangles from i*CLUSTER_TRIANGLES
+    struct Cluster
+    {
+        float center[3];    // the bounding sphere
+        float radius;
+        float axis[3];      // the cone of normals
+        float coneSin;      // the sine of cone angle (1 if the cone is not less than 90 deg)
+    };
+    // the range of clusters [begin, end)
+    struct ClusterRun
+    {
+        uint32_t begin;
+        uint32_t end;
+    };
+    std::vector<Cluster>               m_clusters;       // empty if the vertices are changed
+    std::vector<uint32_t>              m_clusterEdges;   // the edges of cluster i start from m_clusterEdges[i]
+    std::vector<ClusterRun>            m_triangleRuns;   // the clusters drawn by the last frame
+    std::vector<ClusterRun>            m_edgeRuns;       // the clusters in view (their edges are drawn)
+    std::vector<GLint>                 m_drawFirst;      // the ranges of drawn arrays
+    std::vector<GLsizei>               m_drawCount;
+    std::vector<const void*>           m_drawOffsets;
+    PFNGLMULTIDRAWARRAYSPROC           m_multiDrawArrays;    // OpenGL 1.4, nullptr if absent
+    PFNGLMULTIDRAWELEMENTSPROC         m_multiDrawElements;
+    GLdouble                           m_viewWidth;      // the half sizes of view in the eye coordinates
+    GLdouble                           m_viewHeight;
+    // the input only changes the view below, the changes of all events are drawn
+    // by one frame per display refresh and no frame is drawn if the view is the same
+    struct ViewState
+    {
+        common::Vector rotate;
+        common::Vector buildDirection;
+        GLdouble translX;
+        GLdouble translZ;
+        GLdouble scale;
+        bool operator == (const ViewState &other) const;
+    };
+    ViewState                          m_drawnView;      // the view of the last frame
+    QTimer                             m_frameTimer;     // the next frame drawn by input
+    QElapsedTimer                      m_frameClock;     // from the start of the last frame
+    QElapsedTimer                      m_inputClock;     // from the first input not drawn yet
+    QElapsedTimer                      m_drawnInputClock; // the input clock of the last frame until it's swapped
+    bool                               m_rotationPending; // the build rotation is applied by the next frame
 
     common::Vector                     m_buildDirection;
+    common::Vector                     m_bakedDirection; // the build direction of m_vertices
     common::Vector                     m_rotate;         // the rotation angle
     GLdouble                           m_translX;        // translation by Z axis
     GLdouble                           m_translZ;        // translation by Z axis
@@ -54,8 +160,37 @@ private:
 
     int m_showMask;
     bool m_needsUpdate;
+    bool m_isPreview;       // the loading model is shown by its part, it can't be rotated or analyzed
+    bool m_releaseHidden;   // free the derived buffers of hidden elements
+    bool m_deferRotation;   // the build rotation is drawn by transform until Shift is released
+    bool m_frustumCulling;  // the clusters out of view are not drawn
+    bool m_backFaceCulling; // the back faces are not drawn (the clusters facing away are skipped)
+
+    // the derived buffers of element are not kept while it's hidden
+    inline bool isReleased(int mask) const {return m_releaseHidden && !(m_showMask & mask);}
+    inline bool isDegenerate(uint32_t iTri) const
+    {
+        return (m_degenerateMask[iTri / 64] >> (iTri % 64)) & 1;
+    }
+
+    // the normal Z and the highest Z of triangles from the baked normals and vertices
+    void updateOverhangData();
 
-    bool vertexOnTheGround(size_t iVert);
+    void updateBoundBox();
+    void fitScale();
+    void updateNormalVertices();
+    // the grid is built by the frame for its view
+    void updateGround();
+    void updateGroundGrid();
+    void addGroundLines(double step, double halfSize, bool skipCoarse);
+    void updateAdjacency();
+    // the work of updateAll() inside of its memory stage
+    bool updateTopology(std::vector<common::Edge> &&edges,
+                        std::vector<uint32_t> &&triangleEdges, uint32_t firstFacet);
+    Color triangleColor(uint32_t iTri) const;
+    void updateDrawPositions();
+    void updateDrawColors();
+    void updateDrawColors(const std::pmr::vector<uint32_t> &triangles);
 
     void scaleUp();
     void scaleDown();
@@ -71,6 +206,8 @@ private:
     void translateRight();
     void defaultScene();
 
+    // the build direction is changed interactively
+    void rotateModel();
     void rotateModelUpX();
     void rotateModelDownX();
     void rotateModelUpY();
@@ -78,11 +215,31 @@ private:
     void rotateModelUpZ();
     void rotateModelDownZ();
 
+    void setProjection();
     void drawAxis();
     void drawWireframe();
     void drawTriangles();
     void drawNormals();
     void drawGround();
+    // the view is changed, the simplified level is drawn until it stays still
+    void interact();
+    ViewState viewState() const;
+    // draw the changes of view by the next frame (not earlier than one refresh after the last one)
+    void requestFrame();
+    void drawRequestedFrame();
+    void frameSwapped();
+    const common::MeshLevel *interactiveLevel() const;
+    void drawLevel(const common::MeshLevel &level);
+    // the clusters of triangles are culled by the current view before drawing
+    void updateClusters();
+    void cullClusters();
+    // set the ranges of the arrays with 'unit' items per triangle or edge for the runs
+    void setTriangleRanges(const std::vector<ClusterRun> &runs, size_t unit);
+    void setEdgeRanges(const std::vector<ClusterRun> &runs, size_t unit);
+    void drawRanges(GLenum mode);
+    void drawIndexedRanges(GLenum mode);
+    // free the buffers on GPU (the context is made current)
+    void destroyBuffers();
 
     bool fixTrianglesOrientation(const common::Triangle &tria1, common::Triangle &tria2,
                                  const common::Edge &edge) const;
@@ -99,15 +256,70 @@ protected:
     void updateForDraw();
 
 public:
+    // the memory of buffer in bytes
+    struct BufferMemory
+    {
+        const char *name;
+        size_t size;
+        size_t capacity;
+    };
+    // the culling of the last frame drawn the full model
+    struct CullStats
+    {
+        size_t clusters = 0;
+        size_t frustumCulled = 0;       // the clusters out of view
+        size_t backFaceCulled = 0;      // the clusters in view facing away
+        size_t submittedTriangles = 0;
+        size_t culledTriangles = 0;
+        size_t submittedEdges = 0;
+        size_t culledEdges = 0;
+    };
+    // the frames drawn by input since the last reset
+    struct FrameStats
+    {
+        size_t inputEvents = 0;     // the events which asked for a frame
+        size_t frames = 0;          // the frames drawn by input
+        size_t skippedFrames = 0;   // not drawn because the view was the same
+        double lastFrameMs = 0.0;   // the time of paintGL (the commands are not waited for)
+        double maxFrameMs = 0.0;
+        double totalFrameMs = 0.0;
+        double lastLatencyMs = 0.0; // from the first input of frame to the swap of its buffers
+        double maxLatencyMs = 0.0;
+        double totalLatencyMs = 0.0;
+    };
+
     Scene3D(QWidget *parent = nullptr);
+    ~Scene3D() override;
     bool setModel(std::vector<common::Vertex> &&vertices,
                   std::vector<common::Triangle> &&faces);
-    bool fitModel(bool firstLoad = false);
+    // restore the model analyzed before, nothing is recalculated
+    bool setModel(MeshCacheData &&data);
+    // get the model as it is right after loading to store it in cache
+    void getCacheData(MeshCacheData &data) const;
+    bool fitModel();
     bool updateAll();
+    // use the edges built from the current triangles (in another thread for example),
+    // firstFacet is the triangle which was the first facet of file before the spatial sort
+    bool updateAll(std::vector<common::Edge> &&edges,
+                   std::vector<uint32_t> &&triangleEdges, uint32_t firstFacet = 0);
+    // show the part of model while it's loading, no topology and analysis are available
+    bool setPreview(std::vector<common::Vertex> &&vertices,
+                    std::vector<common::Triangle> &&faces);
     void changeOrientation();
-    bool poligonize(double angleInRadians = 0.9);
-    double detectSupportedTriangles();
+    // split the model into faces, the neighbor triangles with the cosine of angle
+    // between normals not less than minCosine are in one face
+    bool poligonize(double minCosine = 0.9);
+    // the triangles with the normals closer than overhangAngle (degrees) to the down direction
+    // need support unless they lie on the ground, return their area; the detection uses
+    // the baked normals only, so the rotated model must be fitted (fitModel) before it
+    double detectSupportedTriangles(double overhangAngle = 45.0);
     void applyModelRotation();
+    void setDeferRotation(bool defer);
+    void setFrustumCulling(bool cull);
+    void setBackFaceCulling(bool cull);
+    inline const CullStats &cullStats() const {return m_cullStats;}
+    inline const FrameStats &frameStats() const {return m_frameStats;}
+    inline void resetFrameStats() {m_frameStats = FrameStats();}
 
     void keyPressEvent(QKeyEvent* pe) override;
     void keyReleaseEvent(QKeyEvent *re) override;
@@ -117,6 +329,23 @@ public:
     void setGroundHeight(double value);
 
     inline double totalArea() {return m_totalArea;}
+    // get the model in the coordinates of file (with the fixed orientation of facets)
+    void getModel(std::vector<common::Vertex> &vertices,
+                  std::vector<common::Triangle> &faces) const;
     inline int &showMask() {return m_showMask;}
+    // free or restore the derived buffers after the change of showMask
+    void updateVisibility();
+    void setReleaseHidden(bool release);
+    // the simplified levels of current model, the finest first
+    void setLevels(std::vector<common::MeshLevel> &&levels);
+    inline const std::vector<common::VertexF> &verticesOrig() const {return m_verticesOrig;}
+    inline const std::vector<common::Triangle> &triangles() const {return m_triangles;}
+    void memoryReport(std::vector<BufferMemory> &report) const;
     inline common::Vertex &buildDirection() {return m_buildDirection;}
+    // the rotation of view around X, Y and Z axes (degrees)
+    inline common::Vector &viewRotation() {return m_rotate;}
+
+private:
+    CullStats m_cullStats;
+    FrameStats m_frameStats;
 };
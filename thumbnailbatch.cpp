@@ -0,0 +1,248 @@
+#include "thumbnailbatch.h"
+#include "functions.h"
+#include "rasterizer.h"
+#include <QDir>
+#include <QDirIterator>
+#include <QFileInfo>
+#include <QElapsedTimer>
+#include <QImage>
+#include <QDebug>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace {
+
+// the model file and its image
+struct ThumbnailJob
+{
+    QString modelPath;
+    QString imagePath;
+};
+
+// the model loaded by a worker thread
+struct LoadedThumbnail
+{
+    size_t job = 0;
+    bool loaded = false;
+    QString error;
+    std::vector<common::Vertex> vertices;
+    std::vector<common::Triangle> faces;
+    uint32_t firstFacet = 0;    // the first facet of file after the spatial sort
+    std::vector<common::Edge> edges;
+    std::vector<uint32_t> triangleEdges;
+    QImage image;   // drawn on CPU by the loading thread
+};
+
+// the models passed from the loading threads to the rendering one, the loading
+// threads wait while the queue is full, so only a few models are kept in memory
+class ThumbnailQueue
+{
+    std::mutex m_mutex;
+    std::condition_variable m_changed;
+    std::deque<std::unique_ptr<LoadedThumbnail>> m_models;
+    size_t m_capacity;
+    size_t m_loaders;   // the loading threads which are still running
+
+public:
+    ThumbnailQueue(size_t capacity, size_t loaders) : m_capacity(capacity), m_loaders(loaders) {}
+
+    void push(std::unique_ptr<LoadedThumbnail> model)
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this]() {return m_models.size() < m_capacity;});
+        m_models.push_back(std::move(model));
+        m_changed.notify_all();
+    }
+
+    // the loading thread has no more models
+    void finish()
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_loaders;
+        m_changed.notify_all();
+    }
+
+    // take the next model, nullptr if all models are taken
+    std::unique_ptr<LoadedThumbnail> pop()
+    {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_changed.wait(lock, [this]() {return !m_models.empty() || m_loaders == 0;});
+        if (m_models.empty())
+            return nullptr;
+        std::unique_ptr<LoadedThumbnail> model = std::move(m_models.front());
+        m_models.pop_front();
+        m_changed.notify_all();
+        return model;
+    }
+};
+
+// the image of model is 'relativePath' in the output folder with the extension of PNG
+QString imagePath(const QDir &outputDir, const QString &relativePath)
+{
+    QFileInfo info(relativePath);
+    return QDir::cleanPath(outputDir.filePath(info.path() + "/" + info.completeBaseName() + ".png"));
+}
+
+// draw the model by the CPU rasterizer, the null image if nothing is drawn
+template<typename V>
+QImage rasterizeThumbnail(const std::vector<V> &vertices, const std::vector<common::Triangle> &faces,
+                          const ThumbnailOptions &options, unsigned threads)
+{
+    RasterImage raster;
+    if (!rasterizeMesh(vertices, faces, rasterView(options.rotate),
+                       options.size, options.size, raster, true, threads))
+        return QImage();
+    QImage image(reinterpret_cast<const uchar*>(raster.colors.data()), raster.width, raster.height,
+                 QImage::Format_RGB32);
+    // the copy owns the pixels
+    return image.copy();
+}
+
+void collectJobs(const ThumbnailOptions &options, std::vector<ThumbnailJob> &jobs)
+{
+    const QStringList filters = {"*.stl", "*.obj", "*.ply", "*.cmsh"};
+    const QDir outputDir(options.outputDir);
+    for (const QString &input : options.inputs)
+    {
+        QFileInfo info(input);
+        if (!info.isDir())
+        {
+            jobs.push_back({info.absoluteFilePath(), imagePath(outputDir, info.fileName())});
+            continue;
+        }
+
+        // the models of subfolders get the same subfolders of the output one
+        QDir dir(info.absoluteFilePath());
+        QDirIterator it(dir.path(), filters, QDir::Files, QDirIterator::Subdirectories);
+        while (it.hasNext())
+        {
+            QString path = it.next();
+            jobs.push_back({path, imagePath(outputDir, dir.relativeFilePath(path))});
+        }
+    }
+}
+
+}
+
+int renderThumbnails(const ThumbnailOptions &options)
+{
+    std::vector<ThumbnailJob> jobs;
+    collectJobs(options, jobs);
+    if (jobs.empty())
+    {
+        qWarning() << "No models to render";
+        return 0;
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    // the loading threads take the models by the shared counter, every model
+    // is loaded by one thread, so the threads of one model are not needed
+    const size_t nThreads = std::min<size_t>(workerThreads(options.threads), jobs.size());
+    ThumbnailQueue queue(2 * nThreads, nThreads);
+    std::atomic<size_t> nextJob(0);
+    // the loading threads draw the models by themselves without OpenGL
+    std::atomic<bool> cpuDrawing(options.cpu);
+    std::vector<std::thread> loaders;
+    loaders.reserve(nThreads);
+    for (size_t i = 0; i < nThreads; ++i)
+    {
+        loaders.emplace_back([&]()
+        {
+            for (size_t job = nextJob++; job < jobs.size(); job = nextJob++)
+            {
+                auto model = std::make_unique<LoadedThumbnail>();
+                model->job = job;
+                model->loaded = loadModel(jobs[job].modelPath, model->vertices, model->faces, model->error,
+                                          options.tolerance);
+                if (model->loaded && cpuDrawing)
+                {
+                    // only the image is queued
+                    model->image = rasterizeThumbnail(model->vertices, model->faces, options, 1);
+                    std::vector<common::Vertex>().swap(model->vertices);
+                    std::vector<common::Triangle>().swap(model->faces);
+                }
+                else if (model->loaded)
+                {
+                    std::vector<uint32_t> permutation;
+                    sortTrianglesSpatially(model->vertices, model->faces, 1, nullptr, nullptr, &permutation);
+                    buildEdges(model->faces, model->edges, model->triangleEdges, 1);
+                    auto first = std::find(permutation.begin(), permutation.end(), 0u);
+                    if (first != permutation.end())
+                        model->firstFacet = static_cast<uint32_t>(first - permutation.begin());
+                }
+                queue.push(std::move(model));
+            }
+            queue.finish();
+        });
+    }
+
+    // the scene is never shown, it's drawn into its framebuffer only
+    Scene3D scene;
+    scene.resize(options.size, options.size);
+    size_t rendered = 0;
+    while (std::unique_ptr<LoadedThumbnail> model = queue.pop())
+    {
+        const ThumbnailJob &job = jobs[model->job];
+        if (!model->loaded)
+        {
+            qWarning().noquote() << job.modelPath << ":" << model->error;
+            continue;
+        }
+        QImage image = std::move(model->image);
+        if (image.isNull() && !cpuDrawing)
+        {
+            if (!scene.setModel(std::move(model->vertices), std::move(model->faces)) ||
+                !scene.updateAll(std::move(model->edges), std::move(model->triangleEdges), model->firstFacet))
+            {
+                qWarning().noquote() << job.modelPath << ": Incorrect format of the model!";
+                continue;
+            }
+            scene.showMask() = options.showMask;
+            scene.viewRotation() = options.rotate;
+            image = scene.grabFramebuffer();
+            if (image.isNull())
+            {
+                // the next models are drawn on CPU by the loading threads
+                qWarning() << "OpenGL is not available to draw offscreen, the models are drawn on CPU";
+                cpuDrawing = true;
+                image = rasterizeThumbnail(scene.verticesOrig(), scene.triangles(), options, 0);
+            }
+        }
+        else if (image.isNull() && !model->vertices.empty())
+        {
+            // the model was loaded for OpenGL before the switch to the CPU drawing
+            image = rasterizeThumbnail(model->vertices, model->faces, options, 0);
+        }
+        if (image.isNull())
+        {
+            qWarning().noquote() << job.modelPath << ": the model has no triangles to draw";
+            continue;
+        }
+        QDir().mkpath(QFileInfo(job.imagePath).path());
+        if (!image.save(job.imagePath, "PNG"))
+        {
+            qWarning().noquote() << job.imagePath << ": the image can't be written";
+            continue;
+        }
+
+        ++rendered;
+        if (rendered % 100 == 0)
+            qInfo().noquote() << QString("%1 of %2 thumbnails, %3 files/s").arg(rendered).arg(jobs.size())
+                                 .arg(rendered * 1000.0 / std::max<qint64>(timer.elapsed(), 1), 0, 'f', 1);
+    }
+    for (std::thread &loader : loaders)
+        loader.join();
+
+    const double seconds = timer.elapsed() / 1000.0;
+    qInfo().noquote() << QString("%1 of %2 thumbnails in %3 s, %4 files/s")
+                         .arg(rendered).arg(jobs.size()).arg(seconds, 0, 'f', 2)
+                         .arg(seconds > 0.0 ? rendered / seconds : 0.0, 0, 'f', 1);
+    return static_cast<int>(jobs.size() - rendered);
+}
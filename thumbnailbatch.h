@@ -0,0 +1,25 @@
+#pragma once
+
+#include "common.h"
+#include "functions.h"
+#include "scene3d.h"
+#include <QString>
+#include <QStringList>
+
+// the options of rendering the thumbnails of models without window
+struct ThumbnailOptions
+{
+    QStringList inputs;     // the model files and the folders searched for them
+    QString outputDir;      // the images keep the paths of models relative to their folders
+    int size = 256;         // the width and the height of image in pixels
+    common::Vector rotate = {-90.0, 0.0, 0.0}; // the view rotation around X, Y and Z (degrees)
+    int showMask = shWireframe | shTriangles;
+    unsigned threads = 0;   // the loading threads (0 - the number of cores)
+    bool cpu = false;       // draw the shaded triangles by the CPU rasterizer instead of OpenGL
+    WeldTolerance tolerance; // the welding of STL models
+};
+
+// load the models in parallel threads and draw them one by one by the offscreen Scene3D
+// in the current (GUI) thread, the loading threads draw the models by the CPU rasterizer
+// if it's asked or OpenGL is not available, return the number of models without thumbnails
+int renderThumbnails(const ThumbnailOptions &options);